@@ -2,235 +2,355 @@
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <numeric>
 #include <queue>
 #include <random>
+#include <unistd.h>
 
+#include "bitmap.hpp"
 #include "center_result_set.hpp"
+#include "checkpoint.hpp"
 #include "daily_site.hpp"
+#include "demand_kernels.hpp"
 #include "file_parser.hpp"
+#include "first_fit_index.hpp"
+#include "fixed_priority_queue.hpp"
+#include "policy.hpp"
+#include "problem_input.hpp"
+#include "radix_sort.hpp"
+#include "residual_demand.hpp"
 #include "result_set.hpp"
+#include "solution_format.hpp"
+#include "strategy.hpp"
+#include "thread_pool.hpp"
+#include "topology.hpp"
 
 using namespace std;
-using DemandIter = unordered_map<string, vector<int>>::iterator;
 
-class SystemManager {
-public:
-    SystemManager() = default;
-    SystemManager(const string &output_filename) { output_fp_ = fopen(output_filename.c_str(), "w"); }
-    ~SystemManager() {
-        if (output_fp_) {
-            fclose(output_fp_);
+// 调度实例使用的文件，多个实例时每个实例的路径加上各自的后缀
+struct StorageOptions {
+    string result_storage;         // 为空时所有天的分配结果都保存在内存中
+    string checkpoint;             // 为空时不写检查点
+    size_t checkpoint_interval{0}; // 每调度这么多天写一次检查点，0表示只在所有天调度完成后写
+    bool resume{false};            // 从检查点记录的天继续调度
+    StorageOptions WithSuffix(const string &suffix) const {
+        StorageOptions options = *this;
+        if (!result_storage.empty()) {
+            options.result_storage += suffix;
+        }
+        if (!checkpoint.empty()) {
+            options.checkpoint += suffix;
+        }
+        return options;
+    }
+};
+
+// 把重新调度的天写回输出文件，重新调度的天由format_day(day, out)格式化到out。文本长度不变的天原地覆盖；
+// 从第一个长度变化的天开始，之后的内容都要移动，这部分整段读出后重写，未重新调度的天按原来的字节复制，
+// 代价与这一段的长度成正比。day_offsets为每天在文件中的起始位置，最后一个元素为文件长度，
+// 成功时更新为新的偏移；任何读写失败时返回false，偏移不变
+template <typename FormatDay>
+bool RewriteSolutionTail(const string &output_filename, vector<long> &day_offsets,
+                         const vector<size_t> &rescheduled_days, FormatDay format_day) {
+    if (rescheduled_days.empty()) {
+        return true;
+    }
+    FILE *fp = fopen(output_filename.c_str(), "r+b");
+    if (fp == nullptr) {
+        return false;
+    }
+    vector<string> texts(rescheduled_days.size());
+    for (size_t i = 0; i < rescheduled_days.size(); i++) {
+        format_day(rescheduled_days[i], texts[i]);
+    }
+    bool ok = true;
+    size_t k = 0;
+    for (; k < rescheduled_days.size(); k++) {
+        size_t day = rescheduled_days[k];
+        if (texts[k].size() != static_cast<size_t>(day_offsets[day + 1] - day_offsets[day])) {
+            break;
+        }
+        ok = ok && fseek(fp, day_offsets[day], SEEK_SET) == 0 &&
+             fwrite(texts[k].data(), 1, texts[k].size(), fp) == texts[k].size();
+    }
+    if (!ok || k == rescheduled_days.size()) {
+        return fclose(fp) == 0 && ok;
+    }
+    size_t first = rescheduled_days[k];
+    long start = day_offsets[first];
+    string old_tail(day_offsets.back() - start, '\0');
+    if (fseek(fp, start, SEEK_SET) != 0 || fread(&old_tail[0], 1, old_tail.size(), fp) != old_tail.size()) {
+        fclose(fp);
+        return false;
+    }
+    string new_tail;
+    vector<long> new_offsets(day_offsets.begin(), day_offsets.begin() + first + 1);
+    for (size_t day = first; day + 1 < day_offsets.size(); day++) {
+        if (k < rescheduled_days.size() && rescheduled_days[k] == day) {
+            new_tail += texts[k];
+            k++;
+        } else {
+            new_tail.append(old_tail, day_offsets[day] - start, day_offsets[day + 1] - day_offsets[day]);
         }
+        new_offsets.push_back(start + new_tail.size());
     }
+    ok = fseek(fp, start, SEEK_SET) == 0 && fwrite(new_tail.data(), 1, new_tail.size(), fp) == new_tail.size() &&
+         fflush(fp) == 0 && ftruncate(fileno(fp), start + new_tail.size()) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        return false;
+    }
+    day_offsets = move(new_offsets);
+    return true;
+}
+
+class SystemManager {
+public:
+    // 可以并行的阶段都在pool上执行，多个SystemManager共用同一个pool
+    SystemManager(const ProblemInput &input, const Strategy &strategy, ThreadPool &pool = ThreadPool::Instance())
+        : strategy_(strategy), qos_constraint_(input.qos_constraint), base_cost_(input.base_cost),
+          center_cost_(input.center_cost), sites_(input.sites), clients_(input.clients), demands_(input.demands),
+          pool_(pool) {}
     // 初始化系统模块
     void Init();
     // 不断读取时间戳的请求并且处理
     void Process();
+    // 总成绩，Process之后有效
+    int GetTotalGrade() const { return total_grade_; }
+    // 边缘结点的成绩，Process或Reschedule之后有效
+    int GetEdgeGrade() const { return edge_grade_; }
+    // 某天中心结点的负载
+    int GetCenterLoad(size_t day) const { return center_results_.GetLoad(day); }
+    // 将某天每个客户的分配格式化为输出中的一行，lines[i]对应第i个客户，用于合并多个子问题的输出
+    void FormatDayLines(size_t day, vector<string> &lines);
+    // 将某天的分配加入二进制解，client_ids和site_ids把下标映射回原问题，为空时不映射
+    void AppendBinaryDay(size_t day, solution_format::Writer &writer, const vector<size_t> &client_ids,
+                         const vector<size_t> &site_ids);
+    // 打印成绩和各服务器的负载
+    void PrintReport();
+    // 向/output/solution.txt中写出所有天的结果，文件无法打开或写入失败时返回false
+    bool WriteSolution(const string &output_filename);
+    // 部分天的需求被修正后（调用者已替换ProblemInput中对应的Demand），只重新调度这些天，
+    // 以及遗留流量变化后原有分配超出容量的后续天，返回重新调度的天
+    vector<size_t> Reschedule(vector<size_t> changed_days);
+    // 只重写输出文件中从第一个重新调度的天开始的部分，读写失败时返回false，保留原来的偏移
+    bool UpdateSolution(const string &output_filename, const vector<size_t> &rescheduled_days);
+    // 每天的分配结果保存在path对应的内存映射文件中，需要在Init之前调用
+    void SetResultStorage(const string &path) { result_storage_ = path; }
+    // 设置检查点文件和写入间隔，resume为true时Process从检查点继续，跳过预设打满和已完成的天。
+    // 检查点只记录逐天调度的结果，之后的优化阶段不写检查点，恢复后重新执行
+    void SetCheckpoint(const string &path, size_t interval, bool resume) {
+        checkpoint_ = path;
+        checkpoint_interval_ = interval;
+        resume_ = resume;
+    }
+    // 流式调度：逐个读取时间戳，只保留当前天之后window天的需求用于选择打满的天，
+    // 每天调度完成后立即写出该天的结果并释放分配表，只保留计算成绩需要的负载，输出文件无法打开时返回false
+    bool ProcessStreaming(FileParser &file_parser, size_t window, const string &output_filename);
 
 private:
-    FILE *output_fp_{stdout};
-    FileParser file_parser_;
+    Strategy strategy_;
     int qos_constraint_;
     int base_cost_;
     double center_cost_;
     vector<Site> sites_;
     vector<bool> site_used_;
     vector<Client> clients_;
-    vector<Demand> demands_; // demands all mtimes
-    vector<vector<int>> client_demands_;
+    // 排序后客户和服务器之间的可达关系
+    Topology topology_;
+    const vector<Demand> &demands_; // demands all mtimes, shared by all strategies
+    ThreadPool &pool_;
     unique_ptr<ResultSet> results_;
     CenterResultSet center_results_;
     vector<vector<size_t>> daily_full_site_indexes_;
-    vector<set<size_t>> daily_full_site_set_;
+    // 天×服务器，预设在这一天打满的服务器
+    BitMatrix daily_full_site_bits_;
+    // 流式调度时只需要当天和前一天的预设打满，按天循环使用这么多行，为0时每天一行
+    size_t full_rows_{0};
+    static constexpr size_t STREAM_FULL_ROWS = 2;
+    size_t FullRow(size_t day) const { return full_rows_ == 0 ? day : day % full_rows_; }
+    // PresetMaxSites中一个服务器选中打满的天和其中的空缺，每个服务器复用
+    Bitmap has_day_;
+    Bitmap holes_;
+    // 当天还未分配的需求
+    ResidualDemand residual_;
+    int total_grade_{0};
+    int edge_grade_{0};
+    // 调度开始前和每天调度结束后所有服务器的状态，用于从任意一天开始重新调度
+    vector<Site::State> initial_states_;
+    vector<vector<Site::State>> end_states_;
+    // 输出文件中每天的起始位置，最后一个元素为文件长度
+    vector<long> day_offsets_;
+    // 为空时所有天的分配结果都保存在内存中
+    string result_storage_;
+    string checkpoint_;
+    size_t checkpoint_interval_{0};
+    // 检查点中已经保存的天数和最后一个完整段的结尾，为0时下一次写检查点重新写出文件头和基础部分
+    size_t checkpoint_days_{0};
+    size_t checkpoint_end_{0};
+    bool resume_{false};
+    // 分配时按流量大小排序用的基数排序缓冲区
+    RadixSorter<pair<size_t, int>> pair_sorter_;
+    RadixSorter<Stream> stream_sorter_;
+    // 按服务器或流汇总需求时复用的缓冲区，以流、客户、服务器下标索引
+    vector<int> stream_sums_;
+    // BaseAllocate中当天的剩余需求（流×客户）、可选服务器的掩码（客户×服务器）和得分（流×服务器），
+    // 服务器一维补齐到8的倍数
+    vector<int> residual_matrix_;
+    vector<int> site_mask_;
+    vector<int> score_matrix_;
+    // 每天调度中复用的缓冲区，只清空不释放，稳定后分配过程不再申请内存
+    vector<pair<size_t, int>> sums_;
+    vector<pair<size_t, int>> cli_strs_;
+    vector<Stream> pending_streams_;
+    // AverageAllocate中每个客户第一个不超过分位值就能放下流的服务器
+    FirstFitIndex first_fit_;
+    // 服务器少于这个数的客户直接扫描
+    static constexpr size_t FIRST_FIT_MIN_SITES = 16;
 
     // 对于每一个时间戳的请求进行调度
-    void Schedule(Demand &d, int day);
+    template <typename CostPolicy>
+    void Schedule(const Demand &d, int day);
+    // 完成一天的分配并更新服务器的分位值，不保存结果
+    template <typename CostPolicy>
+    void AllocateDay(const Demand &d, int day);
     // 贪心将可以分配满的site先分配满
-    void GreedyAllocate(Demand &d, int day);
+    void GreedyAllocate(ResidualDemand &need, int day);
     // 分配到base cost上下
-    void BaseAllocate(Demand &d);
+    void BaseAllocate(ResidualDemand &need);
     // 平均分
-    void AverageAllocate(Demand &d);
+    template <typename CostPolicy>
+    void AverageAllocate(ResidualDemand &need);
+    // 服务器在FirstFitIndex中的值：不超过分位值并且不超过剩余容量时还能接收的流量
+    // 流量都是正数，不足时记为0，这样在AverageAllocate中只减不增
+    int GetFirstFitKey(size_t site_idx) const;
     // 获取第i个client的第j个边缘结点
     Site &GetSite(int i, int j) { return sites_[clients_[i].GetSiteIndex(j)]; }
-    // 向/output/solution.txt中写出结果
-    void WriteSchedule(const Result &res);
+    // 将一天的结果格式化为/output/solution.txt中的文本
+    void FormatSchedule(const Result &res, string &out);
+    // 一个客户在一天中的分配，即输出中的一行
+    void FormatClient(const Result &res, size_t cli_idx, string &out);
+    // 输入和策略的指纹，检查点只能用于相同的输入和策略
+    uint64_t GetFingerprint() const;
+    // 写出前days_done天调度完成后的状态，只追加上一次检查点之后完成的天
+    void WriteCheckpoint(size_t days_done);
+    // 从检查点恢复预设打满的天、服务器状态和已完成天的结果，返回已完成的天数，不可用时返回0
+    size_t LoadCheckpoint();
     // 根据函数计算当前应该打满次数
     int GetFullTimes(const Demand &d);
     // 获取成绩
     long GetGrade();
+    // 按照选定的策略完成所有天的调度
+    template <typename SiteOrder, typename CostPolicy>
+    void ScheduleAll();
+    // 迁移流之后服务器上各条流的最大值改变，根据每天的分配结果重新计算中心结点的负载
+    void UpdateCenterLoads();
     // 预先设定好每天需要打满的服务器
+    template <typename SiteOrder>
     void PresetMaxSites();
+    // 全局的延迟贪心：所有(服务器, 天)按可以吸收的需求放在一个堆中，每次取收益最大的打满，
+    // 某天的剩余需求变化后，该天的候选到达堆顶时才重新计算收益
+    void PlanFullDays();
+    // 模拟将服务器在某天打满，在剩余需求中标记被吸收的流
+    void PresetFullDay(size_t site_idx, ResidualDemand &need);
+    template <typename CostPolicy>
+    vector<size_t> RescheduleDays(const vector<size_t> &changed_days);
+    // 需求没变的一天只因为开始时的遗留流量不同而改变时，保留原有分配得到的结束状态；
+    // 分位值不同、分配放不下或无法确定分位值是否更新时返回false，该天需要重新调度
+    bool ShiftEndState(size_t day, size_t site_idx, const Site::State &old_start, const Site::State &new_start,
+                       const Site::State &old_end, Site::State &new_end) const;
+    // 写出失败时返回false
+    template <typename SiteOrder, typename CostPolicy>
+    bool StreamAll(FileParser &file_parser, size_t window, FILE *fp);
+    // 每个服务器在某天最多可以吸收的需求
+    void ComputePotentials(const Demand &d, vector<int> &potentials);
+    // 服务器在剩余需求中可以吸收的流量，不计超过服务器容量的流
+    int GetAbsorbable(size_t site_idx, const ResidualDemand &need) const;
+    // 每条流在服务器的客户上剩余需求之和，只包含和不为0的流，按流下标升序
+    void GetSiteStreamSums(size_t site_idx, const ResidualDemand &need, vector<pair<size_t, int>> &sums);
+    // 流式调度时根据窗口内的需求决定窗口第一天打满的服务器
+    void PresetStreamDay(const deque<Demand> &window, const deque<vector<int>> &potentials, size_t day,
+                         const vector<size_t> &site_order, vector<int> &used_slots);
 };
 
 void SystemManager::Init() {
-    file_parser_.ParseSites(sites_);
-    file_parser_.ParseConfig(qos_constraint_, base_cost_, center_cost_);
-    file_parser_.ParseQOS(clients_, qos_constraint_);
     site_used_.resize(sites_.size(), true);
-    // 向服务器中添加客户
-    for (size_t i = 0; i < clients_.size(); i++) {
-        for (const auto site_idx : clients_[i].GetAccessibleSite()) {
-            sites_[site_idx].AddRefClient(i);
-        }
-    }
-    // 对于每一个服务器
-    std::for_each(sites_.begin(), sites_.end(), [this](Site &site) {
-        // 对服务器中的客户进行排序
-        sort(site.GetRefClients().begin(), site.GetRefClients().end(), [this](int l, int r) {
-            auto GetAvailable = [this](int cli_idx) -> int {
-                int ret = 0;
-                for (size_t site_idx : clients_[cli_idx].GetAccessibleSite()) {
-                    ret += sites_[site_idx].GetTotalBandwidth() / sites_[site_idx].GetRefTimes();
-                }
-                return ret;
-            };
-            return GetAvailable(l) < GetAvailable(r);
-        });
-    });
-    // 对客户进行排序
-    std::sort(clients_.begin(), clients_.end(),
-              [](const Client &l, const Client &r) { return l.GetSiteCount() < r.GetSiteCount(); });
-    // std::sort(clients_.begin(), clients_.end(),
-    //           [this](const Client &l, const Client &r) {
-    //               auto GetAvailable = [this](const Client &cli) -> int {
-    //                   int ret = 0;
-    //                   for (size_t site_idx : cli.GetAccessibleSite()) {
-    //                       ret += sites_[site_idx].GetTotalBandwidth() /
-    //                              sites_[site_idx].GetRefTimes();
-    //                   }
-    //                   return ret;
-    //               };
-    //               return GetAvailable(l) < GetAvailable(r);
-    //           });
-    unordered_map<size_t, size_t> cli_idx_map;
-    for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
-        cli_idx_map[clients_[cli_idx].GetID()] = cli_idx;
-        clients_[cli_idx].SetID(cli_idx);
-    }
-    // 对于每一个客户
-    std::for_each(clients_.begin(), clients_.end(), [this](Client &cli) {
-        // 计算client的可以被提供的量
-        for (auto site_idx : cli.GetAccessibleSite()) {
-            auto &site = sites_[site_idx];
-            cli.AddAccessTotal(site.GetTotalBandwidth() / site.GetRefTimes());
-        }
-    });
     std::for_each(clients_.begin(), clients_.end(), [this](Client &cli) {
         // 将客户中的服务器进行排序
-        sort(cli.GetAccessibleSite().begin(), cli.GetAccessibleSite().end(),
-             [this](int l, int r) { return sites_[l].GetRefTimes() < sites_[r].GetRefTimes(); });
-        // sort(cli.GetAccessibleSite().begin(), cli.GetAccessibleSite().end(),
-        //      [this](int l, int r) {
-        //          auto RefClientsNeed = [this](int site_idx) -> long {
-        //             long ret = 0;
-        //             auto &site = sites_[site_idx];
-        //             for (size_t cli_idx : site.GetRefClients()) {
-        //                 ret += clients_[cli_idx].GetAccessTotal();
-        //             }
-        //             return ret;
-        //          };
-        //          return RefClientsNeed(l) > RefClientsNeed(r);
-        //      });
+        if (strategy_.client_site_order == ClientSiteOrder::REF_TIMES) {
+            sort(cli.GetAccessibleSite().begin(), cli.GetAccessibleSite().end(),
+                 [this](int l, int r) { return sites_[l].GetRefTimes() < sites_[r].GetRefTimes(); });
+        } else {
+            sort(cli.GetAccessibleSite().begin(), cli.GetAccessibleSite().end(), [this](int l, int r) {
+                auto RefClientsNeed = [this](int site_idx) -> long {
+                    long ret = 0;
+                    auto &site = sites_[site_idx];
+                    for (size_t cli_idx : site.GetRefClients()) {
+                        ret += clients_[cli_idx].GetAccessTotal();
+                    }
+                    return ret;
+                };
+                return RefClientsNeed(l) > RefClientsNeed(r);
+            });
+        }
     });
-    // 排序后需要改变原来服务器和file_parser中对应的下标
+    // 排序后构建可达关系，客户中服务器对应的槽位直接查表
+    topology_.Build(clients_, sites_);
     for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
-        clients_[cli_idx].ReInit();
-    }
-    file_parser_.RebuildClientMap(clients_);
-    for (auto &site : sites_) {
-        site.ResetClientIndex(cli_idx_map);
+        clients_[cli_idx].BindSlots(topology_.GetSlots(cli_idx));
     }
-    // 读取所有时刻的请求
-    while (file_parser_.ParseDemand(clients_.size(), demands_))
-        ;
     results_ = unique_ptr<ResultSet>(new ResultSet(sites_, clients_, base_cost_));
+    results_->SetThreadPool(&pool_);
     // results_->Reserve(demands_.size());
     results_->Resize(demands_.size());
     center_results_.Resize(demands_.size());
+    if (!result_storage_.empty() && !results_->EnableMappedStorage(result_storage_, demands_)) {
+        printf("cannot map %s, keep results in memory\n", result_storage_.c_str());
+    }
 
     // 根据所有时刻的请求初始化一些信息
     for (auto &site : sites_) {
         site.SetMaxFullTimes(demands_.size() / 20);
     }
-    for (size_t i = 0; i < demands_.size(); i++) {
-        auto d = demands_[i];
-        client_demands_.push_back(vector<int>(clients_.size(), 0));
-        for (size_t j = 0; j < clients_.size(); j++) {
-            client_demands_[i][j] = d.GetClientDemand(j);
-        }
-    }
 }
 
 struct DailySiteCmp {
     bool operator()(const DailySite &a, const DailySite &b) { return a.GetTotal() < b.GetTotal(); }
 };
 
-struct DailySiteByDayCmp {
-    bool operator()(const DailySite &a, const DailySite &b) { return a.GetTime() > b.GetTime(); }
-};
-
+template <typename SiteOrder>
 void SystemManager::PresetMaxSites() {
     std::vector<size_t> max_site_indexes;
     for (size_t i = 0; i < sites_.size(); i++) {
         max_site_indexes.push_back(i);
         sites_[i].SetSeperateBandwidth(base_cost_);
     }
-    // Sort by site capacity
-    auto sites_copy = sites_;
-    sort(max_site_indexes.begin(), max_site_indexes.end(), [&sites_copy](size_t l, size_t r) {
-        // return sites_copy[l].GetTotalBandwidth() > sites_copy[r].GetTotalBandwidth();
-        int ltimes = sites_copy[l].GetRefTimes();
-        int rtimes = sites_copy[r].GetRefTimes();
-        if (ltimes != rtimes) {
-            return ltimes > rtimes;
-        }
-        return sites_copy[l].GetTotalBandwidth() > sites_copy[r].GetTotalBandwidth();
-    });
-    sort(sites_copy.begin(), sites_copy.end(), [](const Site &l, const Site &r) {
-        // return l.GetTotalBandwidth() > r.GetTotalBandwidth();
-        int ltimes = l.GetRefTimes();
-        int rtimes = r.GetRefTimes();
-        if (ltimes != rtimes) {
-            return ltimes > rtimes;
-        }
-        return l.GetTotalBandwidth() > r.GetTotalBandwidth();
-    });
+    SiteOrder order;
+    sort(max_site_indexes.begin(), max_site_indexes.end(),
+         [this, &order](size_t l, size_t r) { return order(sites_[l], sites_[r]); });
 
 
-    auto client_demands_cpy = client_demands_;
-    auto demand_copy = demands_;
+    // 模拟打满时只在剩余需求上标记，不需要复制所有需求
+    const int full_days = demands_.size() * strategy_.full_day_ratio;
+    vector<ResidualDemand> residuals(demands_.size());
+    pool_.ParallelFor(0, demands_.size(), 16, [this, &residuals](size_t day) { residuals[day].Reset(demands_[day]); });
     daily_full_site_indexes_.resize(demands_.size(), vector<size_t>());
-    daily_full_site_set_.resize(demands_.size(), set<size_t>());
+    daily_full_site_bits_.Reset(demands_.size(), sites_.size());
     for (size_t site_idx : max_site_indexes) {
-        auto site = sites_[site_idx];
-        std::priority_queue<DailySite, std::vector<DailySite>, DailySiteCmp> site_max_req;
-        std::priority_queue<DailySite, std::vector<DailySite>, DailySiteCmp> site_max_req_tem;
-        std::priority_queue<DailySite, std::vector<DailySite>, DailySiteByDayCmp> site_max_req_by_day;
-        for (size_t day = 0; day < client_demands_cpy.size(); day++) {
-
-            site.Reset();
-            int cur_sum = 0;
-            auto &need = demand_copy[day].GetStreamDemands();
-            for (auto it = need.begin(); it != need.end(); it++) {
-                for (size_t cli_idx : sites_[site_idx].GetRefClients()) {
-                    int str_size = it->second[cli_idx];
-                    if (str_size == 0)
-                        continue;
-                    if (str_size > site.GetRemainBandwidth()) {
-                        continue;
-                    }
-                    cur_sum += str_size;
-                }
-            }
+        const auto &site = sites_[site_idx];
+        // 只需要保留每个服务器需求最大的5%天
+        fixed_size_priority_queue<DailySite, DailySiteCmp> site_max_req(full_days);
+        for (size_t day = 0; day < demands_.size(); day++) {
+            int cur_sum = GetAbsorbable(site_idx, residuals[day]);
             if (cur_sum > 0) {
-                site_max_req.push({day, site_idx, cur_sum, sites_[site_idx].GetTotalBandwidth()});
-                site_max_req_tem.push({day, site_idx, cur_sum, sites_[site_idx].GetTotalBandwidth()});
+                site_max_req.push({day, site_idx, cur_sum, site.GetTotalBandwidth()});
             }
         }
+        auto site_max_req_tem = site_max_req;
 //        if (!site_max_req.empty() && site_max_req.top().GetTotal() < base_cost_ * 3) {
 //            sites_[site_max_req.top().GetSiteIdx()].SetTotalBandwidth(0);
 //            sites_[site_max_req.top().GetSiteIdx()].SetSeperateBandwidth(0);
@@ -251,18 +371,19 @@ void SystemManager::PresetMaxSites() {
 //        }
         int slot = 0;
         int Used = 0;
-        set<int> hasDay;
+        Bitmap &hasDay = has_day_;
+        hasDay.Reset(demands_.size());
         vector<int> extra;
-        int max = (int)(demands_.size() * 0.05) - 1;
+        int max = full_days - 1;
         int day = -2;
 
-        for (int j = 0; j < (int)(demands_.size() * 0.05); j++) {
+        for (int j = 0; j < full_days; j++) {
             if (!site_max_req_tem.empty()) {
                 auto &daily_site = site_max_req_tem.top();
                 int day = daily_site.GetTime();
-                if (hasDay.count(day-1) && hasDay.count(day+1)) {
+                if (hasDay.Test(day-1) && hasDay.Test(day+1)) {
                     slot = slot;
-                } else if (hasDay.count(day - 1) || hasDay.count(day + 1)) {
+                } else if (hasDay.Test(day - 1) || hasDay.Test(day + 1)) {
                     slot++;
                 } else {
                     slot += 2;
@@ -271,180 +392,598 @@ void SystemManager::PresetMaxSites() {
                 if (slot >= max) {
                     break;
                 }
-                hasDay.insert(day);
+                hasDay.Set(day);
                 site_max_req_tem.pop();
             }
         }
 
-        for (int i = 0; i < demands_.size(); i++) {
-            if (hasDay.count(i-1) && hasDay.count(i+1) && !hasDay.count(i)) {
+        // 只有空缺的天会被加入，条件只在加入之后变化，因此直接按顺序遍历空缺
+        hasDay.GetHoles(holes_);
+        if (!(hasDay.Count() > max)) {
+            for (size_t i = holes_.NextSet(0); i < holes_.Size(); i = holes_.NextSet(i + 1)) {
                 extra.push_back(i);
-            }
-            if (extra.size() + hasDay.size() > max) {
-                break;
+                if (extra.size() + hasDay.Count() > max) {
+                    break;
+                }
             }
         }
 
 //        if (!site_max_req.empty() && site_max_req.top().GetTotal() <= base_cost_ * 20) {
 //            sites_[site_max_req.top().GetSiteIdx()].SetTotalBandwidth(base_cost_ * 20);
 //        }
-        for (int j = 0; j < hasDay.size(); j++) {
+        for (int j = 0; j < hasDay.Count(); j++) {
             if (site_max_req.empty()) {
                 break;
             }
-            DailySite daily_site = site_max_req.top();
-            int day = daily_site.GetTime();
-            auto site = sites_[daily_site.GetSiteIdx()];
-            site.Reset();
-            auto &need = demand_copy[day].GetStreamDemands();
-
-            vector<pair<DemandIter, int>> sums;
-            sums.reserve(need.size());
-            for (auto it = need.begin(); it != need.end(); it++) {
-                int sumv = 0;
-                for (size_t cli_idx : site.GetRefClients()) {
-                    sumv += it->second[cli_idx];
-                }
-                sums.push_back({it, sumv});
-            }
-            std::sort(sums.begin(), sums.end(), [](const pair<DemandIter, int> &l, const pair<DemandIter, int> &r) {
-                return l.second > r.second;
-            });
-
-            vector<pair<size_t, int>> cli_strs;
-            cli_strs.reserve(site.GetRefTimes());
-            for (const auto &p : sums) {
-                auto it = p.first;
-                cli_strs.clear();
-                for (size_t cli_idx : site.GetRefClients()) {
-                    cli_strs.push_back({cli_idx, it->second[cli_idx]});
-                }
-                std::sort(cli_strs.begin(), cli_strs.end(),
-                          [](const pair<size_t, int> &l, const pair<size_t, int> &r) { return l.second < r.second; });
-                int i;
-                for (i = cli_strs.size() - 1; i >= 0; i--) {
-                    size_t cli_idx = cli_strs[i].first;
-                    int str_size = cli_strs[i].second;
-                    if (str_size > site.GetRemainBandwidth()) {
-                        break;
-                    }
-                    if (str_size == 0) {
-                        goto next_round;
-                    }
-                    client_demands_cpy[day][cli_idx] = 0;
-                    it->second[cli_idx] = 0;
-                    site.DecreaseBandwidth(str_size);
-                }
-                if (i >= 0) {
-                    for (int j = 0; j < i; j++) {
-                        size_t cli_idx = cli_strs[j].first;
-                        int str_size = cli_strs[j].second;
-                        if (str_size > site.GetRemainBandwidth()) {
-                            goto site_full;
-                        }
-                        if (str_size == 0) {
-                            continue;
-                        }
-                        client_demands_cpy[day][cli_idx] = 0;
-                        it->second[cli_idx] = 0;
-                        site.DecreaseBandwidth(str_size);
-                    }
-                }
-                next_round:;
-            }
-            site_full:;
-
-            daily_full_site_indexes_[day].push_back(daily_site.GetSiteIdx());
-            daily_full_site_set_[day].insert(daily_site.GetSiteIdx());
+            int day = site_max_req.top().GetTime();
+            PresetFullDay(site_idx, residuals[day]);
+            daily_full_site_indexes_[day].push_back(site_idx);
+            daily_full_site_bits_.Set(day, site_idx);
             site_max_req.pop();
         }
         for (int j = 0; j < extra.size(); j++) {
-            DailySite daily_site = site_max_req.top();
             int day = extra[j];
-            auto site = sites_[daily_site.GetSiteIdx()];
-            site.Reset();
-            auto &need = demand_copy[day].GetStreamDemands();
-
-            vector<pair<DemandIter, int>> sums;
-            sums.reserve(need.size());
-            for (auto it = need.begin(); it != need.end(); it++) {
-                int sumv = 0;
-                for (size_t cli_idx : site.GetRefClients()) {
-                    sumv += it->second[cli_idx];
-                }
-                sums.push_back({it, sumv});
+            PresetFullDay(site_idx, residuals[day]);
+            daily_full_site_indexes_[day].push_back(site_idx);
+            daily_full_site_bits_.Set(day, site_idx);
+        }
+    }
+}
+
+void SystemManager::PlanFullDays() {
+    for (auto &site : sites_) {
+        site.SetSeperateBandwidth(base_cost_);
+    }
+    const size_t days = demands_.size();
+    const size_t site_count = sites_.size();
+    // 与PresetMaxSites相同的名额：与已选的天相邻只占一个，两边都相邻不占，否则占两个
+    const int max_slots = static_cast<int>(days * strategy_.full_day_ratio) - 1;
+    vector<ResidualDemand> residuals(days);
+    pool_.ParallelFor(0, days, 16, [this, &residuals](size_t day) { residuals[day].Reset(demands_[day]); });
+    daily_full_site_indexes_.assign(days, vector<size_t>());
+    daily_full_site_bits_.Reset(days, site_count);
+
+    // 收益为服务器在该天剩余需求中可以吸收的流量，与PresetMaxSites相同不按容量截断，
+    // 这样同样能打满的天中优先选择需求高峰的天
+    auto gain_of = [this, &residuals](size_t site_idx, size_t day) { return GetAbsorbable(site_idx, residuals[day]); };
+    struct Candidate {
+        int gain;
+        uint32_t day;
+        uint32_t version; // 计算收益时该天剩余需求的版本
+        // 收益相同时天的下标小的优先
+        bool operator<(const Candidate &r) const { return gain != r.gain ? gain < r.gain : day > r.day; }
+    };
+    struct SiteTop {
+        int gain;
+        uint32_t site;
+        bool operator<(const SiteTop &r) const { return gain != r.gain ? gain < r.gain : site > r.site; }
+    };
+    // 每个服务器的候选各自成堆，全局堆中每个还有名额的服务器只有一项，为其堆顶（可能过期）的收益，
+    // 名额用完的服务器连同它所有的候选一起退出
+    vector<vector<Candidate>> candidates(site_count);
+    pool_.ParallelFor(0, site_count, 4, [this, &candidates, &gain_of, days](size_t site_idx) {
+        if (!site_used_[site_idx]) {
+            return;
+        }
+        auto &heap = candidates[site_idx];
+        for (size_t day = 0; day < days; day++) {
+            int gain = gain_of(site_idx, day);
+            if (gain > 0) {
+                heap.push_back({gain, static_cast<uint32_t>(day), 0});
             }
-            std::sort(sums.begin(), sums.end(), [](const pair<DemandIter, int> &l, const pair<DemandIter, int> &r) {
-                return l.second > r.second;
-            });
+        }
+        make_heap(heap.begin(), heap.end());
+    });
+    vector<SiteTop> tops;
+    for (size_t site_idx = 0; site_idx < site_count; site_idx++) {
+        if (max_slots > 1 && !candidates[site_idx].empty()) {
+            tops.push_back({candidates[site_idx].front().gain, static_cast<uint32_t>(site_idx)});
+        }
+    }
+    make_heap(tops.begin(), tops.end());
 
-            vector<pair<size_t, int>> cli_strs;
-            cli_strs.reserve(site.GetRefTimes());
-            for (const auto &p : sums) {
-                auto it = p.first;
-                cli_strs.clear();
-                for (size_t cli_idx : site.GetRefClients()) {
-                    cli_strs.push_back({cli_idx, it->second[cli_idx]});
-                }
-                std::sort(cli_strs.begin(), cli_strs.end(),
-                          [](const pair<size_t, int> &l, const pair<size_t, int> &r) { return l.second < r.second; });
-                int i;
-                for (i = cli_strs.size() - 1; i >= 0; i--) {
-                    size_t cli_idx = cli_strs[i].first;
-                    int str_size = cli_strs[i].second;
-                    if (str_size > site.GetRemainBandwidth()) {
-                        break;
-                    }
-                    if (str_size == 0) {
-                        goto next_round1;
-                    }
-                    client_demands_cpy[day][cli_idx] = 0;
-                    it->second[cli_idx] = 0;
-                    site.DecreaseBandwidth(str_size);
+    // 每次打满只减少该天的剩余需求，因此收益只减不增，版本没变的堆顶就是当前收益最大的候选
+    vector<uint32_t> versions(days, 0);
+    vector<int> used_slots(site_count, 0);
+    vector<Bitmap> full_days(site_count);
+    for (auto &bits : full_days) {
+        bits.Reset(days);
+    }
+    while (!tops.empty()) {
+        pop_heap(tops.begin(), tops.end());
+        size_t site_idx = tops.back().site;
+        tops.pop_back();
+        auto &heap = candidates[site_idx];
+        pop_heap(heap.begin(), heap.end());
+        Candidate c = heap.back();
+        heap.pop_back();
+        if (c.version != versions[c.day]) {
+            c.gain = gain_of(site_idx, c.day);
+            c.version = versions[c.day];
+            if (c.gain > 0) {
+                heap.push_back(c);
+                push_heap(heap.begin(), heap.end());
+            }
+        } else {
+            auto &bits = full_days[site_idx];
+            bool prev = bits.Test(static_cast<long>(c.day) - 1);
+            bool next = bits.Test(c.day + 1);
+            int slot = prev && next ? 0 : (prev || next ? 1 : 2);
+            if (used_slots[site_idx] + slot < max_slots) {
+                used_slots[site_idx] += slot;
+                bits.Set(c.day);
+                PresetFullDay(site_idx, residuals[c.day]);
+                versions[c.day]++;
+                daily_full_site_indexes_[c.day].push_back(site_idx);
+                daily_full_site_bits_.Set(c.day, site_idx);
+            }
+        }
+        // 剩余名额不够占一个的服务器退出，两边都相邻的空缺在最后统一补上
+        if (used_slots[site_idx] + 1 < max_slots && !heap.empty()) {
+            tops.push_back({heap.front().gain, static_cast<uint32_t>(site_idx)});
+            push_heap(tops.begin(), tops.end());
+        }
+    }
+    // 两边都已打满的空缺也打满，总天数不超过名额
+    for (size_t site_idx = 0; site_idx < site_count; site_idx++) {
+        const auto &bits = full_days[site_idx];
+        bits.GetHoles(holes_);
+        size_t total = bits.Count();
+        for (size_t day = holes_.NextSet(0); day < holes_.Size(); day = holes_.NextSet(day + 1)) {
+            if (static_cast<int>(total) >= max_slots) {
+                break;
+            }
+            total++;
+            PresetFullDay(site_idx, residuals[day]);
+            daily_full_site_indexes_[day].push_back(site_idx);
+            daily_full_site_bits_.Set(day, site_idx);
+        }
+    }
+}
+
+void SystemManager::PresetFullDay(size_t site_idx, ResidualDemand &need) {
+    // 只模拟剩余带宽，不复制服务器
+    int remain = sites_[site_idx].GetBandwidthAfterReset();
+
+    auto &sums = sums_;
+    GetSiteStreamSums(site_idx, need, sums);
+    pair_sorter_.Sort(sums, [](const pair<size_t, int> &p) { return p.second; }, true);
+
+    auto &cli_strs = cli_strs_;
+    for (const auto &p : sums) {
+        size_t s = p.first;
+        cli_strs.clear();
+        for (size_t cli_idx : topology_.GetSiteClients(site_idx)) {
+            cli_strs.push_back({cli_idx, need.Get(s, cli_idx)});
+        }
+        pair_sorter_.Sort(cli_strs, [](const pair<size_t, int> &p) { return p.second; });
+        int i;
+        for (i = cli_strs.size() - 1; i >= 0; i--) {
+            size_t cli_idx = cli_strs[i].first;
+            int str_size = cli_strs[i].second;
+            if (str_size > remain) {
+                break;
+            }
+            if (str_size == 0) {
+                goto next_round;
+            }
+            need.Consume(s, cli_idx);
+            remain -= str_size;
+        }
+        if (i >= 0) {
+            for (int j = 0; j < i; j++) {
+                size_t cli_idx = cli_strs[j].first;
+                int str_size = cli_strs[j].second;
+                if (str_size > remain) {
+                    return;
                 }
-                if (i >= 0) {
-                    for (int j = 0; j < i; j++) {
-                        size_t cli_idx = cli_strs[j].first;
-                        int str_size = cli_strs[j].second;
-                        if (str_size > site.GetRemainBandwidth()) {
-                            goto site_full1;
-                        }
-                        if (str_size == 0) {
-                            continue;
-                        }
-                        client_demands_cpy[day][cli_idx] = 0;
-                        it->second[cli_idx] = 0;
-                        site.DecreaseBandwidth(str_size);
-                    }
+                if (str_size == 0) {
+                    continue;
                 }
-                next_round1:;
+                need.Consume(s, cli_idx);
+                remain -= str_size;
             }
-            site_full1:;
-
-            daily_full_site_indexes_[day].push_back(daily_site.GetSiteIdx());
-            daily_full_site_set_[day].insert(daily_site.GetSiteIdx());
         }
+        next_round:;
     }
 }
 
 void SystemManager::Process() {
-    PresetMaxSites();
+    // 只在这里根据策略和配置选择一次模板实例
+    bool center = center_cost_ > 0;
+    if (strategy_.preset_site_order == PresetSiteOrder::CAPACITY_FIRST) {
+        center ? ScheduleAll<CapacityFirstOrder, WithCenterCost>() : ScheduleAll<CapacityFirstOrder, NoCenterCost>();
+    } else {
+        center ? ScheduleAll<RefTimesFirstOrder, WithCenterCost>() : ScheduleAll<RefTimesFirstOrder, NoCenterCost>();
+    }
+
+    edge_grade_ = results_->GetGrade(false);
+    int center_grade = center_results_.GetGrade();
+    total_grade_ = edge_grade_ + center_grade * center_cost_;
+}
+
+template <typename SiteOrder, typename CostPolicy>
+void SystemManager::ScheduleAll() {
+    size_t first_day = resume_ ? LoadCheckpoint() : 0;
+    if (first_day == 0) {
+        if (strategy_.preset_planner == PresetPlanner::LAZY_GREEDY) {
+            PlanFullDays();
+        } else {
+            PresetMaxSites<SiteOrder>();
+        }
+        initial_states_.clear();
+        for (const auto &site : sites_) {
+            initial_states_.push_back(site.SaveState());
+        }
+        end_states_.resize(demands_.size());
+    } else {
+        printf("resumed %s at day %zu\n", checkpoint_.c_str(), first_day);
+        for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+            sites_[site_idx].RestoreState(end_states_[first_day - 1][site_idx]);
+        }
+    }
     // 对访问demand的顺序进行排序
     vector<size_t> days;
-    for (size_t day_idx = 0; day_idx < demands_.size(); day_idx++) {
+    for (size_t day_idx = first_day; day_idx < demands_.size(); day_idx++) {
         days.push_back(day_idx);
     }
     for (size_t day_idx : days) {
         // for (size_t day_idx = 0; day_idx < demands_.size(); day_idx++) {
         auto &d = demands_[day_idx];
-        Schedule(d, day_idx);
+        Schedule<CostPolicy>(d, day_idx);
+        size_t done = day_idx + 1;
+        if (!checkpoint_.empty() &&
+            (done == demands_.size() || (checkpoint_interval_ > 0 && done % checkpoint_interval_ == 0))) {
+            WriteCheckpoint(done);
+        }
+    }
+
+    if (strategy_.post_optimize) {
+        results_->AdjustTop5();
+        for (size_t times = 1; times <= 20; times++) {
+            results_->Migrate();
+        }
+        UpdateCenterLoads();
+    }
+    // results_->UpdateTop5();
+    // results_->ExpelTop5();
+    // for (auto &site : sites_) {
+    //     site.PrintClients();
+    // }
+    // for (auto &cli : clients_) {
+    //     cli.PrintSites();
+    // }
+}
+
+void SystemManager::UpdateCenterLoads() {
+    unordered_map<string, int> stream_max;
+    for (size_t day = 0; day < demands_.size(); day++) {
+        auto &res = results_->PageIn(day);
+        int load = 0;
+        for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+            stream_max.clear();
+            for (const auto &stream : res.GetSiteStreams(site_idx)) {
+                auto &m = stream_max[stream.stream_name];
+                m = max(m, stream.stream_size);
+            }
+            for (const auto &p : stream_max) {
+                load += p.second;
+            }
+        }
+        results_->PageOut(day, false);
+        center_results_.SetLoad(day, load);
+    }
+}
+
+uint64_t SystemManager::GetFingerprint() const {
+    checkpoint::Fingerprint fp;
+    // 逐个字段加入，避免结构体中的填充字节
+    fp.Add(strategy_.client_site_order);
+    fp.Add(strategy_.preset_site_order);
+    fp.Add(strategy_.full_day_ratio);
+    fp.Add(strategy_.full_sep_factor);
+    fp.Add(strategy_.preset_planner);
+    fp.Add(qos_constraint_);
+    fp.Add(base_cost_);
+    fp.Add(center_cost_);
+    for (const auto &site : sites_) {
+        fp.Add(site.GetName(), strlen(site.GetName()));
+        fp.Add(site.GetTotalBandwidth());
+    }
+    for (const auto &cli : clients_) {
+        fp.Add(cli.GetName(), strlen(cli.GetName()));
+    }
+    for (const auto &d : demands_) {
+        fp.Add(d.GetStreamCount());
+        for (size_t s = 0; s < d.GetStreamCount(); s++) {
+            for (const auto &e : d.GetStreamEntries(s)) {
+                fp.Add(e);
+            }
+        }
+    }
+    return fp.Get();
+}
+
+void SystemManager::WriteCheckpoint(size_t days_done) {
+    if (checkpoint_end_ == 0) {
+        checkpoint::Header header;
+        memcpy(header.magic, checkpoint::MAGIC, sizeof(checkpoint::MAGIC));
+        header.version = checkpoint::VERSION;
+        header.site_count = sites_.size();
+        header.client_count = clients_.size();
+        header.day_count = demands_.size();
+        header.reserved[0] = header.reserved[1] = 0;
+        header.fingerprint = GetFingerprint();
+        checkpoint::Writer writer(header);
+        // 基础部分：每天预设打满的服务器，按天的偏移和服务器下标两部分保存，以及调度开始前的状态
+        vector<uint32_t> full_offsets(1, 0);
+        vector<uint32_t> full_sites;
+        for (const auto &indexes : daily_full_site_indexes_) {
+            full_sites.insert(full_sites.end(), indexes.begin(), indexes.end());
+            full_offsets.push_back(full_sites.size());
+        }
+        writer.Append(full_offsets.data(), full_offsets.size() * sizeof(uint32_t));
+        writer.Append(full_sites.data(), full_sites.size() * sizeof(uint32_t));
+        writer.Append(initial_states_.data(), initial_states_.size() * sizeof(Site::State));
+        if (!writer.Commit(checkpoint_)) {
+            printf("cannot write checkpoint %s\n", checkpoint_.c_str());
+            return;
+        }
+        checkpoint_days_ = 0;
+        checkpoint_end_ = writer.GetSize();
+    }
+    // 新的一段：上一次检查点之后完成的天的结束状态、中心结点负载和分配
+    checkpoint::Writer segment;
+    vector<Site::State> end_states;
+    vector<int> center_loads;
+    for (size_t day = checkpoint_days_; day < days_done; day++) {
+        end_states.insert(end_states.end(), end_states_[day].begin(), end_states_[day].end());
+        center_loads.push_back(center_results_.GetLoad(day));
+    }
+    segment.Append(end_states.data(), end_states.size() * sizeof(Site::State));
+    segment.Append(center_loads.data(), center_loads.size() * sizeof(int));
+    results_->SaveCheckpoint(segment, checkpoint_days_, days_done, demands_);
+    if (!segment.AppendSegment(checkpoint_, checkpoint_end_, checkpoint_days_, days_done - checkpoint_days_)) {
+        // 下一次检查点从同一位置重新追加这些天
+        printf("cannot write checkpoint %s\n", checkpoint_.c_str());
+        return;
+    }
+    checkpoint_days_ = days_done;
+    checkpoint_end_ += sizeof(checkpoint::Segment) + segment.GetSize();
+}
+
+size_t SystemManager::LoadCheckpoint() {
+    checkpoint::Reader reader;
+    if (!reader.Open(checkpoint_)) {
+        return 0;
+    }
+    const auto &header = reader.GetHeader();
+    if (header.site_count != sites_.size() || header.client_count != clients_.size() ||
+        header.day_count != demands_.size() || header.fingerprint != GetFingerprint()) {
+        printf("checkpoint %s does not match the input, start over\n", checkpoint_.c_str());
+        return 0;
+    }
+    size_t site_count = sites_.size();
+    const auto *full_offsets = reader.Take<uint32_t>(demands_.size() + 1);
+    const auto *full_sites = full_offsets == nullptr ? nullptr : reader.Take<uint32_t>(full_offsets[demands_.size()]);
+    const auto *initial = reader.Take<Site::State>(site_count);
+    if (full_sites == nullptr || initial == nullptr) {
+        printf("checkpoint %s is truncated, start over\n", checkpoint_.c_str());
+        return 0;
+    }
+    // 依次恢复各段，到最后一个完整并且与之前的天连续的段为止
+    end_states_.assign(demands_.size(), vector<Site::State>());
+    size_t days_done = 0;
+    size_t end = reader.GetEnd();
+    while (const auto *segment = reader.NextSegment()) {
+        size_t days = segment->day_count;
+        if (segment->first_day != days_done || days > demands_.size() - days_done) {
+            break;
+        }
+        const auto *ends = reader.Take<Site::State>(days * site_count);
+        const auto *center_loads = reader.Take<int>(days);
+        if (ends == nullptr || center_loads == nullptr ||
+            !results_->LoadCheckpoint(reader, days_done, days, demands_)) {
+            break;
+        }
+        for (size_t k = 0; k < days; k++) {
+            end_states_[days_done + k].assign(ends + k * site_count, ends + (k + 1) * site_count);
+            center_results_.SetLoad(days_done + k, center_loads[k]);
+        }
+        days_done += days;
+        end = reader.GetEnd();
+    }
+    if (days_done == 0) {
+        return 0;
+    }
+    checkpoint_days_ = days_done;
+    checkpoint_end_ = end;
+    daily_full_site_indexes_.assign(demands_.size(), vector<size_t>());
+    daily_full_site_bits_.Reset(demands_.size(), sites_.size());
+    for (size_t day = 0; day < demands_.size(); day++) {
+        for (uint32_t k = full_offsets[day]; k < full_offsets[day + 1]; k++) {
+            daily_full_site_indexes_[day].push_back(full_sites[k]);
+            daily_full_site_bits_.Set(day, full_sites[k]);
+        }
+    }
+    initial_states_.assign(initial, initial + site_count);
+    return days_done;
+}
+
+bool SystemManager::ProcessStreaming(FileParser &file_parser, size_t window, const string &output_filename) {
+    FILE *fp = fopen(output_filename.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool center = center_cost_ > 0;
+    bool ok;
+    if (strategy_.preset_site_order == PresetSiteOrder::CAPACITY_FIRST) {
+        ok = center ? StreamAll<CapacityFirstOrder, WithCenterCost>(file_parser, window, fp)
+                    : StreamAll<CapacityFirstOrder, NoCenterCost>(file_parser, window, fp);
+    } else {
+        ok = center ? StreamAll<RefTimesFirstOrder, WithCenterCost>(file_parser, window, fp)
+                    : StreamAll<RefTimesFirstOrder, NoCenterCost>(file_parser, window, fp);
+    }
+    if (fclose(fp) != 0 || !ok) {
+        return false;
+    }
+
+    int grade = results_->GetGrade(false);
+    int center_grade = center_results_.GetGrade();
+    total_grade_ = grade + center_grade * center_cost_;
+    return true;
+}
+
+template <typename SiteOrder, typename CostPolicy>
+bool SystemManager::StreamAll(FileParser &file_parser, size_t window, FILE *fp) {
+    // 总天数未知，预设打满的记录循环使用，每天只追加各服务器的负载和中心结点的负载
+    full_rows_ = STREAM_FULL_ROWS;
+    daily_full_site_indexes_.assign(full_rows_, vector<size_t>());
+    daily_full_site_bits_.Reset(full_rows_, sites_.size());
+    vector<size_t> site_order;
+    for (size_t i = 0; i < sites_.size(); i++) {
+        site_order.push_back(i);
+        sites_[i].SetSeperateBandwidth(base_cost_);
+    }
+    SiteOrder order;
+    sort(site_order.begin(), site_order.end(),
+         [this, &order](size_t l, size_t r) { return order(sites_[l], sites_[r]); });
+
+    // 窗口第一个元素为当前要调度的天，之后最多window天用于比较
+    deque<Demand> demands;
+    deque<vector<int>> potentials;
+    vector<Demand> parsed;
+    vector<int> used_slots(sites_.size(), 0);
+    bool more = true;
+    string text;
+    size_t day = 0;
+    double total_latency = 0;
+    double max_latency = 0;
+    while (more || !demands.empty()) {
+        while (more && demands.size() <= window) {
+            parsed.clear();
+            more = file_parser.ParseDemand(clients_.size(), parsed);
+            if (parsed.back().GetStreamCount() == 0) {
+                continue;
+            }
+            demands.push_back(move(parsed.back()));
+            potentials.emplace_back();
+            ComputePotentials(demands.back(), potentials.back());
+        }
+        if (demands.empty()) {
+            break;
+        }
+        auto start = chrono::high_resolution_clock::now();
+        daily_full_site_indexes_[FullRow(day)].clear();
+        daily_full_site_bits_.ClearRow(FullRow(day));
+        PresetStreamDay(demands, potentials, day, site_order, used_slots);
+        AllocateDay<CostPolicy>(demands.front(), day);
+        {
+            // 写出后分配表随res释放
+            Result res(day, clients_, sites_);
+            text.clear();
+            FormatSchedule(res, text);
+            results_->AppendLoads(res);
+        }
+        center_results_.AddResult(sites_);
+        if (fwrite(text.data(), 1, text.size(), fp) != text.size() || fflush(fp) != 0) {
+            return false;
+        }
+        demands.pop_front();
+        potentials.pop_front();
+        auto end = chrono::high_resolution_clock::now();
+        double latency = chrono::duration<double, milli>(end - start).count();
+        total_latency += latency;
+        max_latency = max(max_latency, latency);
+        day++;
     }
+    printf("streaming: %zu days, window = %zu, latency avg = %.3f ms, max = %.3f ms\n", day, window,
+           day == 0 ? 0 : total_latency / day, max_latency);
+    return true;
+}
+
+void SystemManager::ComputePotentials(const Demand &d, vector<int> &potentials) {
+    ResidualDemand need(d);
+    potentials.resize(sites_.size());
+    for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+        potentials[site_idx] = GetAbsorbable(site_idx, need);
+    }
+}
+
+int SystemManager::GetAbsorbable(size_t site_idx, const ResidualDemand &need) const {
+    const auto &site = sites_[site_idx];
+    int cur_sum = 0;
+    // 单个需求都放得下时，就是引用客户剩余总需求之和
+    if (need.GetMaxDemand() <= site.GetTotalBandwidth()) {
+        for (size_t cli_idx : topology_.GetSiteClients(site_idx)) {
+            cur_sum += need.GetClientTotal(cli_idx);
+        }
+        return cur_sum;
+    }
+    for (size_t cli_idx : topology_.GetSiteClients(site_idx)) {
+        for (const auto &e : need.GetClientEntries(cli_idx)) {
+            if (e.size <= site.GetTotalBandwidth() && !need.IsConsumed(e.index, cli_idx)) {
+                cur_sum += e.size;
+            }
+        }
+    }
+    return cur_sum;
+}
 
-     // results_->AdjustTop5();
-     for (size_t times = 1; times <= 20; times++) {
-         // results_->Migrate();
-     }
+void SystemManager::GetSiteStreamSums(size_t site_idx, const ResidualDemand &need, vector<pair<size_t, int>> &sums) {
+    // 只遍历服务器的客户上的非零需求
+    stream_sums_.assign(need.GetStreamCount(), 0);
+    for (size_t cli_idx : topology_.GetSiteClients(site_idx)) {
+        for (const auto &e : need.GetClientEntries(cli_idx)) {
+            if (!need.IsConsumed(e.index, cli_idx)) {
+                stream_sums_[e.index] += e.size;
+            }
+        }
+    }
+    // 和为0的流在打满时不会分配任何需求，直接去掉
+    sums.clear();
+    for (size_t s = 0; s < stream_sums_.size(); s++) {
+        if (stream_sums_[s] > 0) {
+            sums.push_back({s, stream_sums_[s]});
+        }
+    }
+}
+
+void SystemManager::PresetStreamDay(const deque<Demand> &window, const deque<vector<int>> &potentials, size_t day,
+                                    const vector<size_t> &site_order, vector<int> &used_slots) {
+    // 总天数未知，但至少还有窗口中的天，按已知的天数计算每个服务器可以打满的次数
+    const int full_days = (day + window.size()) * strategy_.full_day_ratio;
+    // 只有在窗口中排在前面的天才打满
+    const size_t top_days = max<size_t>(1, window.size() * strategy_.full_day_ratio);
+    residual_.Reset(window.front());
+    for (size_t site_idx : site_order) {
+        // 和批量调度相同，与前一天相邻的打满只占用一个名额，否则占用两个
+        bool prev_full = day > 0 && daily_full_site_bits_.Test(FullRow(day - 1), site_idx);
+        int slot = prev_full ? 1 : 2;
+        if (used_slots[site_idx] + slot >= full_days - 1) {
+            continue;
+        }
+        int cur_sum = GetAbsorbable(site_idx, residual_);
+        if (cur_sum == 0) {
+            continue;
+        }
+        size_t larger = 0;
+        for (size_t k = 1; k < potentials.size(); k++) {
+            if (potentials[k][site_idx] > cur_sum) {
+                larger++;
+            }
+        }
+        if (larger >= top_days) {
+            continue;
+        }
+        used_slots[site_idx] += slot;
+        PresetFullDay(site_idx, residual_);
+        daily_full_site_indexes_[FullRow(day)].push_back(site_idx);
+        daily_full_site_bits_.Set(FullRow(day), site_idx);
+    }
+}
 
+void SystemManager::PrintReport() {
     int grade = results_->GetGrade();
     printf("grade = %d\n", grade);
     int center_grade = center_results_.GetGrade();
@@ -454,21 +993,154 @@ void SystemManager::Process() {
     // center_results_.PrintGrade();
 
     results_->PrintLoads();
+}
 
-    for (const auto &day_res : *results_) {
-        WriteSchedule(day_res);
+bool SystemManager::WriteSolution(const string &output_filename) {
+    FILE *fp = fopen(output_filename.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
     }
-    // results_->UpdateTop5();
-    // results_->ExpelTop5();
-    // for (auto &site : sites_) {
-    //     site.PrintClients();
-    // }
-    // for (auto &cli : clients_) {
-    //     cli.PrintSites();
-    // }
+    bool ok = true;
+    // 每批天先换入分配表，在pool上并行格式化，再按天的顺序写出
+    size_t batch = pool_.GetWorkerCount() * 4;
+    vector<string> texts(batch);
+    vector<const Result *> day_results(batch);
+    day_offsets_.assign(1, 0);
+    for (size_t first = 0; first < demands_.size(); first += batch) {
+        size_t last = min(demands_.size(), first + batch);
+        for (size_t day = first; day < last; day++) {
+            day_results[day - first] = &results_->PageIn(day);
+        }
+        pool_.ParallelFor(0, last - first, 1, [this, &texts, &day_results](size_t i) {
+            texts[i].clear();
+            FormatSchedule(*day_results[i], texts[i]);
+        });
+        for (size_t day = first; day < last; day++) {
+            results_->PageOut(day, false);
+            const auto &text = texts[day - first];
+            ok = fwrite(text.data(), 1, text.size(), fp) == text.size() && ok;
+            day_offsets_.push_back(day_offsets_.back() + text.size());
+        }
+    }
+    return fclose(fp) == 0 && ok;
 }
 
-void SystemManager::Schedule(Demand &d, int day) {
+vector<size_t> SystemManager::Reschedule(vector<size_t> changed_days) {
+    sort(changed_days.begin(), changed_days.end());
+    changed_days.erase(unique(changed_days.begin(), changed_days.end()), changed_days.end());
+    if (changed_days.empty()) {
+        return {};
+    }
+    auto days = center_cost_ > 0 ? RescheduleDays<WithCenterCost>(changed_days)
+                                 : RescheduleDays<NoCenterCost>(changed_days);
+    edge_grade_ = results_->GetIncrementalGrade();
+    int center_grade = center_results_.GetGrade();
+    total_grade_ = edge_grade_ + center_grade * center_cost_;
+    return days;
+}
+
+template <typename CostPolicy>
+vector<size_t> SystemManager::RescheduleDays(const vector<size_t> &changed_days) {
+    results_->EnableIncrementalGrade();
+    vector<size_t> rescheduled;
+    // 原来的调度中前一天和当天结束时的状态，与新的状态比较决定是否继续向后传播
+    vector<Site::State> prev_old_states;
+    vector<Site::State> old_states;
+    vector<Site::State> shifted(sites_.size());
+    size_t next = 0;
+    while (next < changed_days.size()) {
+        size_t day = changed_days[next];
+        prev_old_states = day == 0 ? initial_states_ : end_states_[day - 1];
+        for (; day < demands_.size(); day++) {
+            bool is_changed = next < changed_days.size() && changed_days[next] == day;
+            if (is_changed) {
+                next++;
+            }
+            old_states = end_states_[day];
+            if (!is_changed) {
+                // 需求没变的天开始时的状态也没变，之后的天都与原来相同
+                const auto &start_states = end_states_[day - 1];
+                if (start_states == prev_old_states) {
+                    break;
+                }
+                // 只有遗留流量变化、原有分配仍放得下时只修改负载，分位值变化时必须重新调度
+                bool fits = true;
+                for (size_t site_idx = 0; site_idx < sites_.size() && fits; site_idx++) {
+                    fits = ShiftEndState(day, site_idx, prev_old_states[site_idx], start_states[site_idx],
+                                         old_states[site_idx], shifted[site_idx]);
+                }
+                if (fits) {
+                    for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+                        results_->SetSiteLoad(day, site_idx,
+                                              sites_[site_idx].GetTotalBandwidth() - shifted[site_idx].remain_bandwidth);
+                    }
+                    end_states_[day] = shifted;
+                    prev_old_states.swap(old_states);
+                    continue;
+                }
+            }
+            const auto &start_states = day == 0 ? initial_states_ : end_states_[day - 1];
+            for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+                sites_[site_idx].RestoreState(start_states[site_idx]);
+            }
+            Schedule<CostPolicy>(demands_[day], day);
+            rescheduled.push_back(day);
+            prev_old_states.swap(old_states);
+        }
+    }
+    return rescheduled;
+}
+
+bool SystemManager::ShiftEndState(size_t day, size_t site_idx, const Site::State &old_start,
+                                  const Site::State &new_start, const Site::State &old_end, Site::State &new_end) const {
+    if (old_start.seperate != new_start.seperate || old_start.tem_seperate != new_start.tem_seperate) {
+        return false;
+    }
+    const auto &site = sites_[site_idx];
+    int total = site.GetTotalBandwidth();
+    int old_load = total - old_end.remain_bandwidth;
+    int load = old_load - site.CarryOver(total - old_start.remain_bandwidth) +
+               site.CarryOver(total - new_start.remain_bandwidth);
+    if (load > total) {
+        return false;
+    }
+    new_end = old_end;
+    new_end.remain_bandwidth = total - load;
+    // 当天打满的服务器不更新分位值。否则分位值只在负载上升的过程中被抬高到当时的负载，
+    // 分配不变时最后一次抬高一定是当天结束时的负载，所以被抬高过就跟随负载变化，
+    // 没有被抬高过且原来的负载超过开始时的分位值，说明当天没有触发更新，分位值不变
+    if (!daily_full_site_bits_.Test(day, site_idx) && old_end.seperate != new_start.seperate) {
+        new_end.seperate = max(new_start.seperate, load);
+    } else if (!daily_full_site_bits_.Test(day, site_idx) && old_load <= new_start.seperate &&
+               load > new_start.seperate) {
+        // 原来的负载没有超过分位值，无法判断是否会触发更新
+        return false;
+    }
+    return true;
+}
+
+bool SystemManager::UpdateSolution(const string &output_filename, const vector<size_t> &rescheduled_days) {
+    return RewriteSolutionTail(output_filename, day_offsets_, rescheduled_days, [this](size_t day, string &out) {
+        FormatSchedule(results_->PageIn(day), out);
+        results_->PageOut(day, false);
+    });
+}
+
+template <typename CostPolicy>
+void SystemManager::Schedule(const Demand &d, int day) {
+    AllocateDay<CostPolicy>(d, day);
+    // results_->AddResult(Result(clients_, sites_));
+    results_->SetResult(day, Result(day, clients_, sites_));
+    center_results_.SetResult(day, sites_);
+    end_states_[day].clear();
+    end_states_[day].reserve(sites_.size());
+    for (const auto &site : sites_) {
+        end_states_[day].push_back(site.SaveState());
+    }
+}
+
+template <typename CostPolicy>
+void SystemManager::AllocateDay(const Demand &d, int day) {
     // 重设所有server的剩余流量
     for (auto &site : sites_) {
         site.Reset();
@@ -476,61 +1148,49 @@ void SystemManager::Schedule(Demand &d, int day) {
     for (auto &client : clients_) {
         client.Reset();
     }
-    GreedyAllocate(d, day);
-    BaseAllocate(d);
-    AverageAllocate(d);
+    residual_.Reset(d);
+    GreedyAllocate(residual_, day);
+    BaseAllocate(residual_);
+    AverageAllocate<CostPolicy>(residual_);
 
     // update sites seperate value
     for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
         auto &site = sites_[site_idx];
         bool flag = true;
-        if (day > 1 && daily_full_site_set_[day-1].count(site_idx))
+        if (day > 1 && daily_full_site_bits_.Test(FullRow(day - 1), site_idx))
             flag = false;
-        if (daily_full_site_set_[day].count(site_idx)) {
-            site.SetTEMSeprateBandwidth(base_cost_ * 3);
+        if (daily_full_site_bits_.Test(FullRow(day), site_idx)) {
+            site.SetTEMSeprateBandwidth(base_cost_ * strategy_.full_sep_factor);
         } else {
             site.SetTEMSeprateBandwidth(0);
         }
         site.ResetSeperateBandwidth(flag);
     }
-    // results_->AddResult(Result(clients_, sites_));
-    results_->SetResult(day, Result(day, clients_, sites_));
-    center_results_.SetResult(day, sites_);
 }
 
-void SystemManager::GreedyAllocate(Demand &d, int day) {
-    auto &need = d.GetStreamDemands();
-    if (daily_full_site_indexes_[day].empty()) {
+void SystemManager::GreedyAllocate(ResidualDemand &need, int day) {
+    const auto &full_sites = daily_full_site_indexes_[FullRow(day)];
+    if (full_sites.empty()) {
         return;
     }
-    for (size_t max_site_idx : daily_full_site_indexes_[day]) {
+    for (size_t max_site_idx : full_sites) {
         if (max_site_idx == -1) {
             return;
         }
         auto &site = sites_[max_site_idx];
 
-        vector<pair<DemandIter, int>> sums;
-        sums.reserve(need.size());
-        for (auto it = need.begin(); it != need.end(); it++) {
-            int sumv = 0;
-            for (size_t cli_idx : site.GetRefClients()) {
-                sumv += it->second[cli_idx];
-            }
-            sums.push_back({it, sumv});
-        }
-        std::sort(sums.begin(), sums.end(),
-                  [](const pair<DemandIter, int> &l, const pair<DemandIter, int> &r) { return l.second > r.second; });
+        auto &sums = sums_;
+        GetSiteStreamSums(max_site_idx, need, sums);
+        pair_sorter_.Sort(sums, [](const pair<size_t, int> &p) { return p.second; }, true);
 
-        vector<pair<size_t, int>> cli_strs;
-        cli_strs.reserve(site.GetRefTimes());
+        auto &cli_strs = cli_strs_;
         for (const auto &p : sums) {
-            auto it = p.first;
+            size_t stream = p.first;
             cli_strs.clear();
-            for (size_t cli_idx : site.GetRefClients()) {
-                cli_strs.push_back({cli_idx, it->second[cli_idx]});
+            for (size_t cli_idx : topology_.GetSiteClients(max_site_idx)) {
+                cli_strs.push_back({cli_idx, need.Get(stream, cli_idx)});
             }
-            std::sort(cli_strs.begin(), cli_strs.end(),
-                      [](const pair<size_t, int> &l, const pair<size_t, int> &r) { return l.second < r.second; });
+            pair_sorter_.Sort(cli_strs, [](const pair<size_t, int> &p) { return p.second; });
             int i;
             for (i = cli_strs.size() - 1; i >= 0; i--) {
                 size_t cli_idx = cli_strs[i].first;
@@ -541,13 +1201,10 @@ void SystemManager::GreedyAllocate(Demand &d, int day) {
                 if (str_size == 0) {
                     goto next_round;
                 }
-                // client_demands_cpy[day][cli_idx] = 0;
-                // it->second[cli_idx] = 0;
-                // site.DecreaseBandwidth(str_size);
-                auto s = Stream(cli_idx, max_site_idx, it->first, str_size);
+                auto s = Stream(cli_idx, max_site_idx, need.GetStreamName(stream), str_size, stream);
                 site.AddStream(s);
                 clients_[cli_idx].AddStreamBySiteIndex(max_site_idx, s);
-                it->second[cli_idx] = 0;
+                need.Consume(stream, cli_idx);
             }
             if (i >= 0) {
                 for (int j = 0; j < i; j++) {
@@ -559,10 +1216,10 @@ void SystemManager::GreedyAllocate(Demand &d, int day) {
                     if (str_size == 0) {
                         continue;
                     }
-                    auto s = Stream(cli_idx, max_site_idx, it->first, str_size);
+                    auto s = Stream(cli_idx, max_site_idx, need.GetStreamName(stream), str_size, stream);
                     site.AddStream(s);
                     clients_[cli_idx].AddStreamBySiteIndex(max_site_idx, s);
-                    it->second[cli_idx] = 0;
+                    need.Consume(stream, cli_idx);
                 }
             }
             next_round:;
@@ -574,75 +1231,80 @@ void SystemManager::GreedyAllocate(Demand &d, int day) {
     }
 }
 
-void SystemManager::BaseAllocate(Demand &d) {
-    auto &need = d.GetStreamDemands();
-    vector<pair<DemandIter, int>> sums;
-    sums.reserve(need.size());
-    for (auto it = need.begin(); it != need.end(); it++) {
-        int sumv = accumulate(it->second.begin(), it->second.end(), 0);
-        sums.push_back({it, sumv});
+void SystemManager::BaseAllocate(ResidualDemand &need) {
+    auto &sums = sums_;
+    sums.clear();
+    for (size_t s = 0; s < need.GetStreamCount(); s++) {
+        sums.push_back({s, need.GetStreamTotal(s)});
     }
-    std::sort(sums.begin(), sums.end(),
-              [](const pair<DemandIter, int> &l, const pair<DemandIter, int> &r) { return l.second > r.second; });
+    pair_sorter_.Sort(sums, [](const pair<size_t, int> &p) { return p.second; }, true);
 
-    set<size_t> sites;
-    for (auto &p : sums) {
-        auto it = p.first;
-        sites.clear();
-        for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
-            if (sites_[site_idx].IsFullThisTime() || !site_used_[site_idx]) {
-                continue;
+    // 每条流在每个服务器上的得分为服务器的客户上剩余需求之和，即剩余需求乘以可达关系，一次算出当天所有的流。
+    // 当天打满或不用的服务器在掩码中为0，得分恒为0，不会被选中
+    const size_t stream_count = need.GetStreamCount();
+    const size_t client_count = clients_.size();
+    const size_t cols = (sites_.size() + 7) / 8 * 8;
+    site_mask_.assign(client_count * cols, 0);
+    for (size_t cli_idx = 0; cli_idx < client_count; cli_idx++) {
+        for (size_t site_idx : topology_.GetClientSites(cli_idx)) {
+            if (!sites_[site_idx].IsFullThisTime() && site_used_[site_idx]) {
+                site_mask_[cli_idx * cols + site_idx] = -1;
             }
-            sites.insert(site_idx);
         }
-        while (!sites.empty()) {
-            int best_grade = 0;
-            int best_site = -1;
-            for (size_t site_idx : sites) {
-                int grade = 0;
-                for (size_t cli_idx : sites_[site_idx].GetRefClients()) {
-                    grade += it->second[cli_idx];
-                }
-                if (grade > best_grade) {
-                    best_grade = grade;
-                    best_site = site_idx;
-                }
-            }
-            if (best_site == -1)
-                break;
+    }
+    residual_matrix_.resize(stream_count * client_count);
+    need.CopyRemaining(residual_matrix_.data());
+    score_matrix_.resize(stream_count * cols);
+    demand_kernels::MaskedProduct(residual_matrix_.data(), stream_count, client_count, site_mask_.data(), cols,
+                                  score_matrix_.data());
+
+    // 一条流的分配只改变它自己的剩余需求和得分，处理到它时得分仍然准确
+    for (auto &p : sums) {
+        size_t stream = p.first;
+        int *row = &residual_matrix_[stream * client_count];
+        int *grades = &score_matrix_[stream * cols];
+        // 得分为正的服务器中得分最大的，相等时选下标最小的
+        for (int best_site; (best_site = demand_kernels::FirstArgMax(grades, cols)) >= 0;) {
+            int best_grade = grades[best_site];
             if (best_grade <= sites_[best_site].GetSeperateBandwidth() - sites_[best_site].GetAllocatedBandwidth()) {
-                for (size_t cli_idx : sites_[best_site].GetRefClients()) {
-                    if (it->second[cli_idx] == 0)
+                for (size_t cli_idx : topology_.GetSiteClients(best_site)) {
+                    int str_size = row[cli_idx];
+                    if (str_size == 0)
                         continue;
-                    auto s = Stream(cli_idx, best_site, it->first, it->second[cli_idx]);
+                    auto s = Stream(cli_idx, best_site, need.GetStreamName(stream), str_size, stream);
                     sites_[best_site].AddStream(s);
                     clients_[cli_idx].AddStreamBySiteIndex(best_site, s);
-                    it->second[cli_idx] = 0;
+                    need.Consume(stream, cli_idx);
+                    row[cli_idx] = 0;
+                    demand_kernels::AddMasked(grades, &site_mask_[cli_idx * cols], -str_size, cols);
                 }
             }
-            sites.erase(best_site);
+            // 每个服务器只选一次
+            grades[best_site] = 0;
         }
     }
 }
 
-void SystemManager::AverageAllocate(Demand &d) {
-    auto &need = d.GetStreamDemands();
-    vector<Stream> streams;
-    for (auto it = need.begin(); it != need.end(); it++) {
-        for (size_t cli_idx = 0; cli_idx < it->second.size(); cli_idx++) {
-            if (it->second[cli_idx] == 0) {
+template <typename CostPolicy>
+void SystemManager::AverageAllocate(ResidualDemand &need) {
+    auto &streams = pending_streams_;
+    streams.clear();
+    for (size_t s = 0; s < need.GetStreamCount(); s++) {
+        for (const auto &e : need.GetStreamEntries(s)) {
+            if (need.IsConsumed(s, e.index)) {
                 continue;
             }
-            streams.push_back(Stream{cli_idx, 0, it->first, it->second[cli_idx]});
+            streams.push_back(Stream{e.index, 0, need.GetStreamName(s), e.size, static_cast<uint32_t>(s)});
         }
     }
-    sort(streams.begin(), streams.end(),
-         [](const Stream &l, const Stream &r) { return l.stream_size > r.stream_size; });
+    stream_sorter_.Sort(streams, [](const Stream &str) { return str.stream_size; }, true);
+    first_fit_.Build(topology_, clients_.size(), FIRST_FIT_MIN_SITES,
+                     [this](size_t site_idx) { return GetFirstFitKey(site_idx); });
     for (auto &str : streams) {
         size_t cli_idx = str.cli_idx;
         auto &cli = clients_[cli_idx];
-        auto &site_indexes = cli.GetAccessibleSite();
-        string stream_name = str.stream_name;
+        auto site_indexes = topology_.GetClientSites(cli_idx);
+        const string &stream_name = str.stream_name;
         if (str.stream_size == 0) {
             continue;
         }
@@ -652,7 +1314,16 @@ void SystemManager::AverageAllocate(Demand &d) {
         long grade = 0;
         int used = 0;
         int sep = 0;
-        for (size_t site_idx : site_indexes) {
+        // 有索引时直接找到第一个不超过分位值的服务器，找不到时下面的扫描只计算代价
+        int first_slot = first_fit_.IsIndexed(cli_idx)
+                             ? first_fit_.FindFirst(cli_idx, str.stream_size,
+                                                    [this](size_t site_idx) { return GetFirstFitKey(site_idx); })
+                             : -1;
+        if (first_slot >= 0) {
+            min_site = site_indexes[first_slot];
+            flag = true;
+        }
+        for (size_t site_idx : first_slot >= 0 ? Topology::IndexRange{nullptr, nullptr} : site_indexes) {
             if (!site_used_[site_idx]) {
                 continue;
             }
@@ -669,8 +1340,7 @@ void SystemManager::AverageAllocate(Demand &d) {
                 break;
             }
             grade = (used * used - sep * sep - 2 * base_cost_ * (used - sep)) / (site.GetTotalBandwidth()) +
-                    (used - sep) +
-                    static_cast<int>(max(0, str.stream_size - site.GetMaxStream(str.stream_name)) * center_cost_);
+                    (used - sep) + CostPolicy::Extra(site, str, center_cost_);
             // printf("site: %ld, grade: %ld\n", site_idx, grade);
             if (grade <= min_grade) {
                 min_site = site_idx;
@@ -681,47 +1351,417 @@ void SystemManager::AverageAllocate(Demand &d) {
         // printf("min site: %d, min grade = %ld\n", min_site, min_grade);
         auto &site = sites_[min_site];
         // site.DecreaseBandwidth(v[C]);
-        site.AddStream(Stream{cli_idx, static_cast<size_t>(min_site), stream_name, str.stream_size});
+        site.AddStream(Stream{cli_idx, static_cast<size_t>(min_site), stream_name, str.stream_size, str.stream_idx});
         site.ResetSeperateBandwidth();
         cli.AddStreamBySiteIndex(min_site,
-                                 Stream{cli_idx, static_cast<size_t>(min_site), stream_name, str.stream_size});
+                                 Stream{cli_idx, static_cast<size_t>(min_site), stream_name, str.stream_size, str.stream_idx});
         // v[cli_idx] = 0;
         assert(flag == true);
     }
 }
 
-void SystemManager::WriteSchedule(const Result &res) {
+int SystemManager::GetFirstFitKey(size_t site_idx) const {
+    if (!site_used_[site_idx]) {
+        return FirstFitIndex::NONE;
+    }
+    const auto &site = sites_[site_idx];
+    return max(0, min(site.GetRemainBandwidth(), site.GetSeperateBandwidth() - site.GetAllocatedBandwidth()));
+}
+
+void SystemManager::FormatSchedule(const Result &res, string &out) {
     // for each client index i
     for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
-        fprintf(output_fp_, "%s:", clients_[cli_idx].GetName());
-        bool flag = false;
-        // for each accessible server j
+        FormatClient(res, cli_idx, out);
+    }
+}
+
+void SystemManager::FormatClient(const Result &res, size_t cli_idx, string &out) {
+    out += clients_[cli_idx].GetName();
+    out += ':';
+    bool flag = false;
+    // for each accessible server j
+    for (size_t S = 0; S < res.GetClientAccessibleSiteCount(cli_idx); S++) {
+        const auto &allocate_list = res.GetAllocationTable(cli_idx, S);
+        int site_idx = topology_.GetClientSites(cli_idx)[S];
+        if (!allocate_list.empty()) {
+            if (flag) {
+                out += ',';
+            }
+            out += '<';
+            out += sites_[site_idx].GetName();
+            for (auto &stream : allocate_list) {
+                out += ',';
+                out += stream.stream_name;
+            }
+            out += '>';
+            flag = true;
+        }
+    }
+    out += '\n';
+}
+
+void SystemManager::FormatDayLines(size_t day, vector<string> &lines) {
+    const auto &res = results_->PageIn(day);
+    lines.resize(clients_.size());
+    for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
+        lines[cli_idx].clear();
+        FormatClient(res, cli_idx, lines[cli_idx]);
+    }
+    results_->PageOut(day, false);
+}
+
+void SystemManager::AppendBinaryDay(size_t day, solution_format::Writer &writer, const vector<size_t> &client_ids,
+                                    const vector<size_t> &site_ids) {
+    const auto &res = results_->PageIn(day);
+    for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
+        size_t out_cli = client_ids.empty() ? cli_idx : client_ids[cli_idx];
+        auto sites = topology_.GetClientSites(cli_idx);
         for (size_t S = 0; S < res.GetClientAccessibleSiteCount(cli_idx); S++) {
-            const auto &allocate_list = res.GetAllocationTable(cli_idx, S);
-            int site_idx = clients_[cli_idx].GetSiteIndex(S);
-            if (!allocate_list.empty()) {
-                if (flag) {
-                    fprintf(output_fp_, ",");
-                }
-                fprintf(output_fp_, "<%s", sites_[site_idx].GetName());
-                for (auto &stream : allocate_list) {
-                    fprintf(output_fp_, ",%s", stream.stream_name.c_str());
-                }
-                fprintf(output_fp_, ">");
-                flag = true;
+            size_t out_site = site_ids.empty() ? sites[S] : site_ids[sites[S]];
+            for (const auto &stream : res.GetAllocationTable(cli_idx, S)) {
+                writer.Add(out_cli, out_site, stream.stream_name);
             }
         }
-        fprintf(output_fp_, "\n");
     }
+    results_->PageOut(day, false);
+}
+
+// 在pool上并行运行strategies中的所有策略，返回总成绩最好的调度结果，成绩相同时取靠前的策略
+// 只有一个策略时直接使用options中的路径，多个策略时每个策略的映射文件和检查点为路径加上.<序号>
+unique_ptr<SystemManager> RunPortfolio(const ProblemInput &input, const vector<Strategy> &strategies,
+                                       const StorageOptions &options, ThreadPool &pool) {
+    vector<unique_ptr<SystemManager>> managers;
+    for (const auto &strategy : strategies) {
+        managers.emplace_back(new SystemManager(input, strategy, pool));
+        auto own = strategies.size() == 1 ? options : options.WithSuffix("." + to_string(managers.size() - 1));
+        if (!own.result_storage.empty()) {
+            managers.back()->SetResultStorage(own.result_storage);
+        }
+        if (!own.checkpoint.empty()) {
+            managers.back()->SetCheckpoint(own.checkpoint, own.checkpoint_interval, own.resume);
+        }
+    }
+    pool.ParallelFor(0, managers.size(), 1, [&managers](size_t i) {
+        managers[i]->Init();
+        managers[i]->Process();
+    });
+    size_t best = 0;
+    for (size_t i = 1; i < managers.size(); i++) {
+        if (managers[i]->GetTotalGrade() < managers[best]->GetTotalGrade()) {
+            best = i;
+        }
+    }
+    if (managers.size() > 1) {
+        printf("portfolio: %zu strategies, best is #%zu\n", managers.size(), best);
+    }
+    return move(managers[best]);
+}
+
+// 可达关系分成多个连通分量时，每个分量是一个独立的子问题，在pool上并行调度并各自选择最好的策略，
+// 输出时按原来的客户顺序合并。边缘结点的成绩按服务器相加；中心结点的成绩是每天所有服务器负载之和的95分位，
+// 需要先把各分量每天的负载相加。只有一个连通分量时直接使用原问题
+class ComponentScheduler {
+public:
+    ComponentScheduler(ProblemInput &input, const vector<Strategy> &strategies, const StorageOptions &storage,
+                       ThreadPool &pool)
+        : input_(input), strategies_(strategies), storage_(storage), pool_(pool) {}
+    // 划分连通分量并完成所有分量的调度
+    void Run();
+    int GetTotalGrade() const { return total_grade_; }
+    void PrintReport();
+    bool WriteSolution(const string &output_filename);
+    // input中部分天的需求已被修正，重新调度受影响的分量，返回重新调度的天
+    vector<size_t> Reschedule(const vector<size_t> &changed_days);
+    bool UpdateSolution(const string &output_filename, const vector<size_t> &rescheduled_days);
+    // 写出二进制列式解，可以用solution_convert还原为solution.txt
+    bool WriteBinarySolution(const string &output_filename);
+
+private:
+    ProblemInput &input_;
+    vector<Strategy> strategies_;
+    StorageOptions storage_;
+    ThreadPool &pool_;
+    vector<Component> components_;
+    vector<unique_ptr<ProblemInput>> sub_inputs_;
+    vector<unique_ptr<SystemManager>> managers_;
+    // 原问题中每个客户所在的分量和在分量中的下标
+    vector<pair<size_t, size_t>> client_owner_;
+    // 输出文件中每天的起始位置，最后一个元素为文件长度
+    vector<long> day_offsets_;
+    int edge_grade_{0};
+    int center_grade_{0};
+    int total_grade_{0};
+
+    void UpdateGrade();
+    // 合并所有分量某天的输出
+    void FormatDay(size_t day, vector<vector<string>> &lines, string &out);
+};
+
+void ComponentScheduler::Run() {
+    components_ = input_.FindComponents();
+    if (components_.size() <= 1) {
+        managers_.push_back(RunPortfolio(input_, strategies_, storage_, pool_));
+        total_grade_ = managers_[0]->GetTotalGrade();
+        return;
+    }
+    client_owner_.resize(input_.clients.size());
+    for (size_t k = 0; k < components_.size(); k++) {
+        for (size_t i = 0; i < components_[k].clients.size(); i++) {
+            client_owner_[components_[k].clients[i]] = {k, i};
+        }
+    }
+    sub_inputs_.resize(components_.size());
+    managers_.resize(components_.size());
+    // 先调度大的分量，使总耗时取决于最大的分量
+    vector<size_t> order(components_.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [this](size_t l, size_t r) {
+        return components_[l].clients.size() > components_[r].clients.size();
+    });
+    pool_.ParallelFor(0, order.size(), 1, [this, &order](size_t i) {
+        size_t k = order[i];
+        sub_inputs_[k].reset(new ProblemInput(input_.Extract(components_[k])));
+        managers_[k] = RunPortfolio(*sub_inputs_[k], strategies_, storage_.WithSuffix(".c" + to_string(k)), pool_);
+    });
+    UpdateGrade();
+}
+
+void ComponentScheduler::UpdateGrade() {
+    edge_grade_ = 0;
+    vector<int> center_loads(input_.demands.size(), 0);
+    for (const auto &manager : managers_) {
+        edge_grade_ += manager->GetEdgeGrade();
+        for (size_t day = 0; day < center_loads.size(); day++) {
+            center_loads[day] += manager->GetCenterLoad(day);
+        }
+    }
+    sort(center_loads.begin(), center_loads.end());
+    center_grade_ = center_loads[ceil(center_loads.size() * 0.95) - 1];
+    total_grade_ = edge_grade_ + center_grade_ * input_.center_cost;
 }
 
-int main() {
+void ComponentScheduler::PrintReport() {
+    if (managers_.size() == 1) {
+        managers_[0]->PrintReport();
+        return;
+    }
+    size_t largest = 0;
+    for (size_t k = 0; k < components_.size(); k++) {
+        printf("component %zu: %zu clients, %zu sites, grade = %d\n", k, components_[k].clients.size(),
+               components_[k].sites.size(), managers_[k]->GetTotalGrade());
+        largest = max(largest, components_[k].clients.size() + components_[k].sites.size());
+    }
+    printf("%zu components, largest has %zu nodes\n", components_.size(), largest);
+    printf("grade = %d\n", edge_grade_);
+    printf("center grade = %d\n", center_grade_);
+    printf("total grade = %d\n", total_grade_);
+}
+
+void ComponentScheduler::FormatDay(size_t day, vector<vector<string>> &lines, string &out) {
+    lines.resize(managers_.size());
+    for (size_t k = 0; k < managers_.size(); k++) {
+        managers_[k]->FormatDayLines(day, lines[k]);
+    }
+    for (const auto &owner : client_owner_) {
+        out += lines[owner.first][owner.second];
+    }
+}
+
+bool ComponentScheduler::WriteSolution(const string &output_filename) {
+    if (managers_.size() == 1) {
+        return managers_[0]->WriteSolution(output_filename);
+    }
+    FILE *fp = fopen(output_filename.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    vector<vector<string>> lines;
+    string text;
+    bool ok = true;
+    day_offsets_.assign(1, 0);
+    for (size_t day = 0; day < input_.demands.size(); day++) {
+        text.clear();
+        FormatDay(day, lines, text);
+        ok = fwrite(text.data(), 1, text.size(), fp) == text.size() && ok;
+        day_offsets_.push_back(day_offsets_.back() + text.size());
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+vector<size_t> ComponentScheduler::Reschedule(const vector<size_t> &changed_days) {
+    if (managers_.size() == 1) {
+        return managers_[0]->Reschedule(changed_days);
+    }
+    // 修正后的需求投影到每个分量，各分量独立地重新调度
+    vector<vector<size_t>> rescheduled(managers_.size());
+    pool_.ParallelFor(0, managers_.size(), 1, [this, &changed_days, &rescheduled](size_t k) {
+        auto &sub = *sub_inputs_[k];
+        for (size_t day : changed_days) {
+            sub.demands[day] = input_.demands[day].Project(components_[k].clients);
+            for (size_t i = 0; i < components_[k].clients.size(); i++) {
+                sub.client_demands[day][i] = input_.client_demands[day][components_[k].clients[i]];
+            }
+        }
+        rescheduled[k] = managers_[k]->Reschedule(changed_days);
+    });
+    vector<size_t> days;
+    for (const auto &r : rescheduled) {
+        days.insert(days.end(), r.begin(), r.end());
+    }
+    sort(days.begin(), days.end());
+    days.erase(unique(days.begin(), days.end()), days.end());
+    UpdateGrade();
+    return days;
+}
+
+bool ComponentScheduler::UpdateSolution(const string &output_filename, const vector<size_t> &rescheduled_days) {
+    if (managers_.size() == 1) {
+        return managers_[0]->UpdateSolution(output_filename, rescheduled_days);
+    }
+    vector<vector<string>> lines;
+    return RewriteSolutionTail(output_filename, day_offsets_, rescheduled_days,
+                               [this, &lines](size_t day, string &out) { FormatDay(day, lines, out); });
+}
+
+bool ComponentScheduler::WriteBinarySolution(const string &output_filename) {
+    vector<string> site_names;
+    vector<string> client_names;
+    for (const auto &site : input_.sites) {
+        site_names.push_back(site.GetName());
+    }
+    for (const auto &client : input_.clients) {
+        client_names.push_back(client.GetName());
+    }
+    solution_format::Writer writer(site_names, client_names);
+    const vector<size_t> identity;
+    for (size_t day = 0; day < input_.demands.size(); day++) {
+        for (size_t k = 0; k < managers_.size(); k++) {
+            if (managers_.size() == 1) {
+                managers_[k]->AppendBinaryDay(day, writer, identity, identity);
+            } else {
+                managers_[k]->AppendBinaryDay(day, writer, components_[k].clients, components_[k].sites);
+            }
+        }
+        writer.EndDay();
+    }
+    return writer.Write(output_filename);
+}
+
+int main(int argc, char *argv[]) {
     auto start = chrono::high_resolution_clock::now();
 
-    // SystemManager manager;
-    SystemManager manager("/output/solution.txt");
-    manager.Init();
-    manager.Process();
+    // --threads N：所有并行阶段共用的线程数（默认为核数）；--pin：工作线程绑定到各自的核上
+    // --portfolio：运行DefaultPortfolio中的所有策略并选择成绩最好的，默认只运行第一个策略，
+    // 两种情况下结果都与线程数无关
+    // --optimize：逐天调度之后运行AdjustTop5和Migrate，不能与需求修正一起使用
+    vector<string> args;
+    size_t threads = 0;
+    bool pin = false;
+    bool portfolio = false;
+    bool optimize = false;
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (string(argv[i]) == "--pin") {
+            pin = true;
+        } else if (string(argv[i]) == "--portfolio") {
+            portfolio = true;
+        } else if (string(argv[i]) == "--optimize") {
+            optimize = true;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    ThreadPool::Configure(threads, pin);
+
+    // --stream W [demand.csv]：流式读取需求（可以是管道，"-"表示标准输入），只用默认策略
+    if (args.size() >= 2 && args[0] == "--stream") {
+        size_t window = atoi(args[1].c_str());
+        ProblemInput input;
+        FileParser file_parser;
+        if (args.size() >= 3) {
+            file_parser.SetDemandFilename(args[2] == "-" ? "/dev/stdin" : args[2]);
+        }
+        input.LoadTopology(file_parser);
+        SystemManager manager(input, DefaultPortfolio().front());
+        manager.Init();
+        if (!manager.ProcessStreaming(file_parser, window, "/output/solution.txt")) {
+            printf("failed to write /output/solution.txt\n");
+            return 1;
+        }
+        manager.PrintReport();
+        auto end = chrono::high_resolution_clock::now();
+        auto duration = chrono::duration_cast<chrono::milliseconds>(end - start);
+        cout << "time taken: " << duration.count() << " ms\n";
+        return 0;
+    }
+
+    // --mapped-results <path>：分配结果保存在映射文件中，内存中只保留负载
+    // --checkpoint <path> [--checkpoint-interval N] [--resume]：调度过程中写检查点，--resume时从检查点继续。
+    //   检查点只覆盖逐天调度，之后的优化阶段在恢复后重新执行
+    // 映射文件和检查点的路径按原样使用；可达关系分成多个连通分量时第k个分量加上.c<k>，
+    // --portfolio时第i个策略再加上.<i>，例如<path>.c0.3，所以--resume时须与写检查点时同样使用或不使用--portfolio
+    // --binary-solution <path>：同时写出二进制列式解，需求修正后重新写出
+    StorageOptions storage;
+    string binary_solution;
+    vector<string> corrections;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--mapped-results" && i + 1 < args.size()) {
+            storage.result_storage = args[++i];
+        } else if (args[i] == "--checkpoint" && i + 1 < args.size()) {
+            storage.checkpoint = args[++i];
+        } else if (args[i] == "--checkpoint-interval" && i + 1 < args.size()) {
+            storage.checkpoint_interval = atoi(args[++i].c_str());
+        } else if (args[i] == "--resume") {
+            storage.resume = true;
+        } else if (args[i] == "--binary-solution" && i + 1 < args.size()) {
+            binary_solution = args[++i];
+        } else {
+            corrections.push_back(args[i]);
+        }
+    }
+    // 重新调度从保存的服务器状态开始，优化阶段迁移后的负载与这些状态不一致
+    if (optimize && !corrections.empty()) {
+        printf("--optimize cannot be used with demand corrections\n");
+        return 1;
+    }
+
+    ProblemInput input;
+    input.Load();
+    // 可达关系不连通时各连通分量分别调度
+    auto strategies = DefaultPortfolio();
+    if (!portfolio) {
+        strategies.resize(1);
+    }
+    for (auto &strategy : strategies) {
+        strategy.post_optimize = optimize;
+    }
+    ComponentScheduler scheduler(input, strategies, storage, ThreadPool::Instance());
+    scheduler.Run();
+    scheduler.PrintReport();
+    if (!scheduler.WriteSolution("/output/solution.txt")) {
+        printf("failed to write /output/solution.txt\n");
+        return 1;
+    }
+
+    // 传入需求修正文件时，只重新调度被修正的时刻并更新输出
+    for (const auto &filename : corrections) {
+        vector<size_t> changed_days;
+        if (!input.ApplyCorrections(filename, changed_days)) {
+            printf("failed to read %s\n", filename.c_str());
+            return 1;
+        }
+        auto rescheduled = scheduler.Reschedule(changed_days);
+        if (!scheduler.UpdateSolution("/output/solution.txt", rescheduled)) {
+            printf("failed to update /output/solution.txt\n");
+            return 1;
+        }
+        printf("corrections %s: rescheduled %zu days, total grade = %d\n", filename.c_str(), rescheduled.size(),
+               scheduler.GetTotalGrade());
+    }
+    if (!binary_solution.empty() && !scheduler.WriteBinarySolution(binary_solution)) {
+        printf("failed to write %s\n", binary_solution.c_str());
+    }
 
     auto end = chrono::high_resolution_clock::now();
     auto duration = chrono::duration_cast<chrono::milliseconds>(end - start);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// 定长位图，越界的下标（包括-1）视为不在集合中，便于检查相邻的天
+class Bitmap {
+  public:
+    // 清空并设置长度
+    void Reset(size_t n) {
+        size_ = n;
+        count_ = 0;
+        words_.assign((n + 63) / 64, 0);
+    }
+    size_t Size() const { return size_; }
+    // 集合中元素的个数
+    size_t Count() const { return count_; }
+    bool Test(long i) const {
+        return i >= 0 && static_cast<size_t>(i) < size_ && ((words_[i >> 6] >> (i & 63)) & 1);
+    }
+    void Set(size_t i) {
+        uint64_t bit = uint64_t(1) << (i & 63);
+        if (!(words_[i >> 6] & bit)) {
+            words_[i >> 6] |= bit;
+            count_++;
+        }
+    }
+    // 不在集合中但前后两个下标都在集合中的位置，按字计算
+    void GetHoles(Bitmap &holes) const {
+        holes.Reset(size_);
+        for (size_t w = 0; w < words_.size(); w++) {
+            uint64_t prev = (words_[w] << 1) | (w > 0 ? words_[w - 1] >> 63 : 0);
+            uint64_t next = (words_[w] >> 1) | (w + 1 < words_.size() ? words_[w + 1] << 63 : 0);
+            holes.words_[w] = prev & next & ~words_[w];
+            holes.count_ += __builtin_popcountll(holes.words_[w]);
+        }
+    }
+    // 不小于i的第一个元素，没有时返回Size()
+    size_t NextSet(size_t i) const {
+        if (i >= size_) {
+            return size_;
+        }
+        size_t w = i >> 6;
+        uint64_t word = words_[w] & (~uint64_t(0) << (i & 63));
+        while (word == 0) {
+            if (++w == words_.size()) {
+                return size_;
+            }
+            word = words_[w];
+        }
+        return (w << 6) + __builtin_ctzll(word);
+    }
+
+  private:
+    size_t size_{0};
+    size_t count_{0};
+    vector<uint64_t> words_;
+};
+
+// 行数可以增长的位矩阵，例如天×服务器，每行按字对齐
+class BitMatrix {
+  public:
+    // 清空并设置大小
+    void Reset(size_t rows, size_t cols) {
+        row_words_ = (cols + 63) / 64;
+        words_.assign(rows * row_words_, 0);
+    }
+    // 行数增加到至少rows，已有的内容不变
+    void ResizeRows(size_t rows) {
+        if (rows * row_words_ > words_.size()) {
+            words_.resize(rows * row_words_, 0);
+        }
+    }
+    // 清空一行，用于循环使用的行
+    void ClearRow(size_t row) { fill_n(words_.begin() + row * row_words_, row_words_, 0); }
+    bool Test(size_t row, size_t col) const { return (words_[row * row_words_ + (col >> 6)] >> (col & 63)) & 1; }
+    void Set(size_t row, size_t col) { words_[row * row_words_ + (col >> 6)] |= uint64_t(1) << (col & 63); }
+
+  private:
+    size_t row_words_{0};
+    vector<uint64_t> words_;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cassert>
+#include <limits>
+#include <vector>
+
+#include "site.hpp"
+
+using namespace std;
+
+// 服务器每天的负载 = 当天分配的流量 + 前一天负载遗留的流量（Site::CarryOver）
+// 保存每个服务器每天的负载和当天还能增加的流量，修改某天的分配后精确地向后传播，
+// 直到遗留流量不再变化为止；还能增加的流量只向前更新到不再变化为止
+class CarryChain {
+  public:
+    static constexpr int UNLIMITED = numeric_limits<int>::max();
+
+    // load_of(day, site_idx)返回当前包含遗留流量的负载
+    template <typename LoadOf>
+    void Build(const vector<Site> &sites, size_t days, LoadOf load_of) {
+        sites_ = &sites;
+        days_ = days;
+        loads_.assign(sites.size(), vector<int>(days, 0));
+        own_.assign(sites.size(), vector<int>(days, 0));
+        headroom_.assign(sites.size(), vector<int>(days, 0));
+        for (size_t site_idx = 0; site_idx < sites.size(); site_idx++) {
+            const auto &site = sites[site_idx];
+            for (size_t day = 0; day < days; day++) {
+                int load = load_of(day, site_idx);
+                loads_[site_idx][day] = load;
+                own_[site_idx][day] = load - (day == 0 ? 0 : site.CarryOver(loads_[site_idx][day - 1]));
+            }
+            for (size_t day = days; day-- > 0;) {
+                headroom_[site_idx][day] = ComputeHeadroom(site_idx, day);
+            }
+        }
+    }
+    int GetLoad(size_t site_idx, size_t day) const { return loads_[site_idx][day]; }
+    // 当天最多还能增加多少流量，使得当天和之后每天的负载都不超过容量
+    int GetHeadroom(size_t site_idx, size_t day) const { return headroom_[site_idx][day]; }
+    // 当天分配的流量变化delta，on_change(day, load)对每个负载改变的天调用一次
+    template <typename OnChange>
+    void Add(size_t site_idx, size_t day, int delta, OnChange on_change) {
+        if (delta == 0) {
+            return;
+        }
+        const auto &site = (*sites_)[site_idx];
+        auto &loads = loads_[site_idx];
+        own_[site_idx][day] += delta;
+        size_t last = day;
+        for (size_t k = day; k < days_; k++) {
+            int load = own_[site_idx][k] + (k == 0 ? 0 : site.CarryOver(loads[k - 1]));
+            if (load == loads[k]) {
+                break;
+            }
+            assert(load <= site.GetTotalBandwidth());
+            loads[k] = load;
+            last = k;
+            on_change(k, load);
+        }
+        // 负载变化的天都要重新计算，更早的天在结果不变时停止
+        for (size_t k = last + 1; k-- > 0;) {
+            int headroom = ComputeHeadroom(site_idx, k);
+            if (k < day && headroom == headroom_[site_idx][k]) {
+                break;
+            }
+            headroom_[site_idx][k] = headroom;
+        }
+    }
+
+  private:
+    const vector<Site> *sites_{nullptr};
+    size_t days_{0};
+    vector<vector<int>> loads_;    // [site][day]，包含遗留流量
+    vector<vector<int>> own_;      // [site][day]，当天分配的流量
+    vector<vector<int>> headroom_; // [site][day]
+
+    // 负载增加到不超过容量，并且遗留到下一天的增量不超过下一天还能增加的流量
+    int ComputeHeadroom(size_t site_idx, size_t day) const {
+        const auto &site = (*sites_)[site_idx];
+        int load = loads_[site_idx][day];
+        int cap = site.GetTotalBandwidth();
+        int next = day + 1 < days_ ? headroom_[site_idx][day + 1] : UNLIMITED;
+        int carry = site.CarryOver(load);
+        if (next == UNLIMITED || site.CarryOver(cap) - carry <= next) {
+            return cap - load;
+        }
+        // 遗留流量随负载单调不减，二分出最大的负载
+        int lo = load;
+        int hi = cap;
+        while (lo < hi) {
+            int mid = lo + (hi - lo + 1) / 2;
+            if (site.CarryOver(mid) - carry <= next) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        return lo - load;
+    }
+};
@@ -34,6 +34,16 @@ public:
         res_[day].Init(sites);
         grades_[day] = res_[day].load_;
     }
+    // 流式调度时追加一天
+    void AddResult(const vector<Site> &sites) {
+        Resize(res_.size() + 1);
+        SetResult(res_.size() - 1, sites);
+    }
+    // 从检查点恢复某天的负载
+    void SetLoad(size_t day, int load) {
+        res_[day].load_ = load;
+        grades_[day] = load;
+    }
     void PrintGrade() {
         auto gs = grades_;
         sort(gs.begin(), gs.end());
@@ -45,6 +55,8 @@ public:
             }
         }
     }
+    // 某天所有服务器上各条流最大值之和
+    int GetLoad(size_t day) const { return grades_[day]; }
     int GetGrade() {
         auto g = grades_;
         sort(g.begin(), g.end());
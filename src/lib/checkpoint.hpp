@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// 调度进度的检查点文件：文件头和基础部分之后是若干段，每段只保存上一次检查点之后新完成的天，
+// 写检查点时只在文件末尾追加一段。每部分按8字节对齐
+// 读取时整个文件只读映射，各部分直接从映射中按顺序取出，不需要逐项解析
+namespace checkpoint {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t site_count;
+    uint32_t client_count;
+    uint32_t day_count;
+    uint32_t reserved[2];
+    uint64_t fingerprint; // 输入和策略的散列，不一致时检查点不可用
+};
+
+// 一段的头，之后是size字节的数据。写入中断时最后一段不完整或校验和不对，读取时忽略，下一次从这里覆盖
+struct Segment {
+    uint32_t first_day;
+    uint32_t day_count;
+    uint64_t size;
+    uint64_t checksum; // 数据的FNV-1a
+};
+
+static const char MAGIC[8] = {'C', 'C', 'C', 'K', 'P', 'T', '0', '1'};
+static const uint32_t VERSION = 3;
+
+// FNV-1a，用于计算输入和策略的指纹
+class Fingerprint {
+  public:
+    void Add(const void *data, size_t size) {
+        const auto *p = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash_ = (hash_ ^ p[i]) * 1099511628211ull;
+        }
+    }
+    template <typename T>
+    void Add(const T &value) {
+        Add(&value, sizeof(value));
+    }
+    uint64_t Get() const { return hash_; }
+
+  private:
+    uint64_t hash_{14695981039346656037ull};
+};
+
+// 在内存中拼接检查点的文件头和基础部分或者一段的数据
+class Writer {
+  public:
+    Writer() = default;
+    explicit Writer(const Header &header) { Append(&header, sizeof(header)); }
+    size_t GetSize() const { return buf_.size(); }
+    // 追加一部分数据并补齐到8字节
+    void Append(const void *data, size_t size) {
+        buf_.append(static_cast<const char *>(data), size);
+        buf_.append((8 - buf_.size() % 8) % 8, '\0');
+    }
+    // 作为新的检查点写出，先写临时文件再改名，进程在写入过程中被杀死时原检查点仍然完整
+    bool Commit(const string &path) const {
+        string tmp = path + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(buf_.data(), 1, buf_.size(), fp) == buf_.size();
+        ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0 && ok;
+        ok = fclose(fp) == 0 && ok;
+        return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+    // 作为一段写到检查点的offset处，即最后一个完整的段之后，并截掉之后的内容
+    bool AppendSegment(const string &path, size_t offset, uint32_t first_day, uint32_t day_count) const {
+        Fingerprint checksum;
+        checksum.Add(buf_.data(), buf_.size());
+        Segment segment{first_day, day_count, buf_.size(), checksum.Get()};
+        FILE *fp = fopen(path.c_str(), "r+b");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool ok = fseek(fp, offset, SEEK_SET) == 0 && fwrite(&segment, sizeof(segment), 1, fp) == 1 &&
+                  fwrite(buf_.data(), 1, buf_.size(), fp) == buf_.size();
+        ok = ok && fflush(fp) == 0 && ftruncate(fileno(fp), offset + sizeof(segment) + buf_.size()) == 0 &&
+             fsync(fileno(fp)) == 0;
+        return fclose(fp) == 0 && ok;
+    }
+
+  private:
+    string buf_;
+};
+
+// 只读映射一个检查点，按写入的顺序取出各部分
+class Reader {
+  public:
+    Reader() = default;
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader() {
+        if (data_ != nullptr) {
+            munmap(const_cast<uint8_t *>(data_), size_);
+        }
+    }
+    // 文件不存在、格式或版本不对时返回false
+    bool Open(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<const uint8_t *>(p);
+        pos_ = sizeof(Header);
+        const auto &header = GetHeader();
+        return memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION;
+    }
+    const Header &GetHeader() const { return *reinterpret_cast<const Header *>(data_); }
+    // 取出下一部分的n个元素，超出文件长度时返回nullptr
+    template <typename T>
+    const T *Take(size_t n) {
+        size_t size = n * sizeof(T);
+        if (pos_ + size > size_) {
+            return nullptr;
+        }
+        const auto *p = reinterpret_cast<const T *>(data_ + pos_);
+        pos_ += (size + 7) / 8 * 8;
+        return p;
+    }
+    // 跳到下一段的数据，之后用Take取出。没有下一段或者下一段不完整、校验和不对时返回nullptr
+    const Segment *NextSegment() {
+        if (end_ != 0) {
+            pos_ = end_;
+        }
+        end_ = pos_;
+        if (size_ - pos_ < sizeof(Segment)) {
+            return nullptr;
+        }
+        const auto *segment = reinterpret_cast<const Segment *>(data_ + pos_);
+        if (segment->size > size_ - pos_ - sizeof(Segment)) {
+            return nullptr;
+        }
+        Fingerprint checksum;
+        checksum.Add(data_ + pos_ + sizeof(Segment), segment->size);
+        if (checksum.Get() != segment->checksum) {
+            return nullptr;
+        }
+        pos_ += sizeof(Segment);
+        end_ = pos_ + segment->size;
+        return segment;
+    }
+    // 上一次NextSegment返回的段的结尾，没有取过段时为当前位置；之后追加的段从这里开始
+    size_t GetEnd() const { return end_ != 0 ? end_ : pos_; }
+
+  private:
+    const uint8_t *data_{nullptr};
+    size_t size_{0};
+    size_t pos_{0};
+    size_t end_{0};
+};
+
+} // namespace checkpoint
@@ -2,10 +2,10 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <list>
 #include <numeric>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include "stream.hpp"
@@ -15,30 +15,36 @@ using namespace std;
 // 服务器到其每个可以访问到的结点的分配情况
 struct AllocationTable {
     vector<list<Stream>> tbl;
-    // from site no to site index
-    unordered_map<size_t, size_t> site_map;
+    // 以服务器下标索引的槽位表，由Topology持有
+    const uint16_t *slots{nullptr};
 
     void Add(size_t n, const Stream &p) { tbl[n].push_back(p); }
-    list<Stream> &GetList(size_t site_idx) {
-        size_t S = site_map[site_idx];
-        return tbl[S];
-    }
-    void MoveStream(const Stream &stream, size_t from, size_t to) {
-        bool flag = false;
-        size_t from_idx = site_map[from];
-        size_t to_idx = site_map[to];
+    list<Stream> &GetList(size_t site_idx) { return tbl[slots[site_idx]]; }
+    // 流在服务器from对应槽位中的位置
+    list<Stream>::iterator Find(const Stream &stream, size_t from) {
+        auto &src = tbl[slots[from]];
         Stream stream_cpy{stream};
-        for (auto it = tbl[from_idx].begin(); it != tbl[from_idx].end(); it++) {
-            if (*it == stream_cpy) {
-                tbl[from_idx].erase(it);
-                flag = true;
-                break;
-            }
+        auto it = src.begin();
+        while (it != src.end() && !(*it == stream_cpy)) {
+            it++;
         }
-        stream_cpy.site_idx = to;
-        tbl[to_idx].push_back(stream_cpy);
-        assert(flag);
+        assert(it != src.end());
+        return it;
+    }
+    // 把结点移到服务器to的槽位末尾，不重新分配结点，返回结点原来的后继
+    list<Stream>::iterator Splice(list<Stream>::iterator it, size_t from, size_t to) {
+        auto next_it = next(it);
+        it->site_idx = to;
+        auto &dst = tbl[slots[to]];
+        dst.splice(dst.end(), tbl[slots[from]], it);
+        return next_it;
     }
+    // 撤销Splice：把结点放回服务器from的槽位中pos之前
+    void Unsplice(list<Stream>::iterator it, size_t from, size_t to, list<Stream>::iterator pos) {
+        it->site_idx = from;
+        tbl[slots[from]].splice(pos, tbl[slots[to]], it);
+    }
+    void MoveStream(const Stream &stream, size_t from, size_t to) { Splice(Find(stream, from), from, to); }
 };
 
 class Client {
@@ -52,18 +58,12 @@ class Client {
     void Init() {
         size_t size = accessible_sites_.size();
         alloc_.tbl.resize(size, list<Stream>{});
-        for (size_t i = 0; i < accessible_sites_.size(); i++) {
-            alloc_.site_map[accessible_sites_[i]] = i;
-        }
-    }
-    void ReInit() {
-        for (size_t i = 0; i < accessible_sites_.size(); i++) {
-            alloc_.site_map[accessible_sites_[i]] = i;
-        }
     }
+    // 服务器排好序并构建Topology之后，绑定服务器下标到槽位的映射
+    void BindSlots(const uint16_t *slots) { alloc_.slots = slots; }
     void Reset() {
         for (auto &l : alloc_.tbl) {
-            l.clear();
+            pool_.Recycle(l);
         }
     }
     size_t GetID() const { return id_; }
@@ -80,24 +80,18 @@ class Client {
 
     const AllocationTable &GetAllocationTable() const { return alloc_; }
 
-    int GetAccessTotal() { return accessible_total; }
+    int GetAccessTotal() const { return accessible_total; }
     void AddAccessTotal(int value) { accessible_total += value; }
 
     void AddStream(size_t idx, const Stream &stream) {
         assert(stream.site_idx == accessible_sites_[idx]);
         assert(id_ == stream.cli_idx);
-        alloc_.tbl[idx].push_back(stream);
+        pool_.Append(alloc_.tbl[idx], stream);
     }
     void AddStreamBySiteIndex(size_t site_idx, const Stream &stream) {
-        bool flag = false;
-        for (size_t i = 0; i < alloc_.tbl.size(); i++) {
-            if (accessible_sites_[i] == site_idx) {
-                AddStream(i, stream);
-                flag = true;
-                break;
-            }
-        }
-        assert(flag == true);
+        size_t slot = alloc_.slots[site_idx];
+        assert(slot < alloc_.tbl.size());
+        AddStream(slot, stream);
         assert(stream.site_idx == site_idx);
         assert(id_ == stream.cli_idx);
     }
@@ -116,5 +110,6 @@ class Client {
     string name_;
     vector<size_t> accessible_sites_; // 可以访问到的服务器集合的index
     AllocationTable alloc_;
+    StreamNodePool pool_;
     int accessible_total{0};
 };
@@ -1,35 +1,126 @@
 #pragma once
 
+#include <cstdint>
 #include <numeric>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "demand_kernels.hpp"
+
 using namespace std;
 
+// 某一时刻所有流的需求，解析完成后不再修改
+// 按行存储：第s行表示第s条流在各个客户上的需求
+// 另外按流和按客户各保存一份只含非零需求的CSR，大多数流只被少数客户请求，遍历时不必扫过整行
 class Demand {
   friend class FileParser;
 
 public:
+  // 一个非零需求，index在按流遍历时为客户下标，按客户遍历时为流下标
+  struct Entry {
+    uint32_t index;
+    int size;
+  };
+  struct EntryRange {
+    const Entry *first;
+    const Entry *last;
+    const Entry *begin() const { return first; }
+    const Entry *end() const { return last; }
+    size_t size() const { return last - first; }
+  };
+
   Demand() = default;
-  string GetTime() { return time_; }
-  unordered_map<string, vector<int>> &GetStreamDemands() { return demands_; }
+  string GetTime() const { return time_; }
+  size_t GetStreamCount() const { return stream_names_.size(); }
+  size_t GetClientCount() const { return client_count_; }
+  const string &GetStreamName(size_t s) const { return stream_names_[s]; }
+  const int *GetStreamDemand(size_t s) const { return &demands_[s * client_count_]; }
+  // 整个流×客户的需求矩阵，没有流时可能为空指针
+  const int *GetDemandData() const { return demands_.data(); }
+  int Get(size_t s, size_t C) const { return demands_[s * client_count_ + C]; }
   long GetTotalDemand() const {
-    long ans = 0;
-    for (auto it = demands_.begin(); it != demands_.end(); it++) {
-      ans += accumulate(it->second.begin(), it->second.end(), 0L);
+    return accumulate(demands_.begin(), demands_.end(), 0L);
+  }
+  // 一次遍历得到每个客户的总需求、每条流的总需求和最大的单个需求
+  void Aggregate(vector<int> &client_totals, vector<int> &stream_totals, int &max_demand) const {
+    client_totals.resize(client_count_);
+    stream_totals.resize(stream_names_.size());
+    demand_kernels::AggregateRows(demands_.data(), stream_names_.size(), client_count_, client_totals.data(),
+                                  stream_totals.data(), max_demand);
+  }
+  // 只保留clients中的客户（按给定顺序作为新的列），去掉在这些客户上需求全为0的流
+  Demand Project(const vector<size_t> &clients) const {
+    Demand d;
+    d.time_ = time_;
+    d.client_count_ = clients.size();
+    for (size_t s = 0; s < stream_names_.size(); s++) {
+      const int *row = GetStreamDemand(s);
+      bool nonzero = false;
+      for (size_t C : clients) {
+        nonzero = nonzero || row[C] != 0;
+      }
+      if (!nonzero) {
+        continue;
+      }
+      d.stream_names_.push_back(stream_names_[s]);
+      for (size_t C : clients) {
+        d.demands_.push_back(row[C]);
+      }
+    }
+    d.BuildSparse();
+    return d;
+  }
+  // 第s条流的非零需求，按客户下标升序
+  EntryRange GetStreamEntries(size_t s) const {
+    return {stream_entries_.data() + stream_offsets_[s], stream_entries_.data() + stream_offsets_[s + 1]};
+  }
+  // 第C个客户的非零需求，按流下标升序
+  EntryRange GetClientEntries(size_t C) const {
+    return {client_entries_.data() + client_offsets_[C], client_entries_.data() + client_offsets_[C + 1]};
+  }
+  // 由按行存储的需求构建两份CSR，需求填好之后调用一次
+  void BuildSparse() {
+    size_t streams = stream_names_.size();
+    stream_offsets_.assign(1, 0);
+    stream_entries_.clear();
+    client_offsets_.assign(client_count_ + 1, 0);
+    for (size_t s = 0; s < streams; s++) {
+      const int *row = GetStreamDemand(s);
+      for (size_t C = 0; C < client_count_; C++) {
+        if (row[C] != 0) {
+          stream_entries_.push_back({static_cast<uint32_t>(C), row[C]});
+          client_offsets_[C + 1]++;
+        }
+      }
+      stream_offsets_.push_back(static_cast<uint32_t>(stream_entries_.size()));
+    }
+    for (size_t C = 0; C < client_count_; C++) {
+      client_offsets_[C + 1] += client_offsets_[C];
+    }
+    client_entries_.resize(stream_entries_.size());
+    vector<uint32_t> next(client_offsets_.begin(), client_offsets_.end() - 1);
+    for (size_t s = 0; s < streams; s++) {
+      for (const auto &e : GetStreamEntries(s)) {
+        client_entries_[next[e.index]++] = {static_cast<uint32_t>(s), e.size};
+      }
     }
-    return ans;
   }
   long GetClientDemand(size_t C) const {
     long ans = 0;
-    for (auto it = demands_.begin(); it != demands_.end(); it++) {
-      ans += it->second[C];
+    for (size_t s = 0; s < stream_names_.size(); s++) {
+      ans += Get(s, C);
     }
     return ans;
   }
 
 private:
   string time_;
-  unordered_map<string, vector<int>> demands_;
+  size_t client_count_{0};
+  vector<string> stream_names_;
+  vector<int> demands_;
+  vector<uint32_t> stream_offsets_;
+  vector<Entry> stream_entries_;
+  vector<uint32_t> client_offsets_;
+  vector<Entry> client_entries_;
 };
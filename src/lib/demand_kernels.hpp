@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DEMAND_KERNELS_X86 1
+#endif
+
+// 需求矩阵（按行存储，每行为一条流在各个客户上的需求）上的归约和与可达关系掩码的乘积
+// x86上运行时根据CPU选择AVX2或SSE2实现，其他平台使用标量实现，三者结果完全相同
+namespace demand_kernels {
+
+namespace detail {
+
+inline void AggregateRowsScalar(const int *m, size_t rows, size_t cols, int *col_sums, int *row_sums,
+                                int &max_value) {
+    for (size_t c = 0; c < cols; c++) {
+        col_sums[c] = 0;
+    }
+    max_value = 0;
+    for (size_t r = 0; r < rows; r++) {
+        const int *row = m + r * cols;
+        int row_sum = 0;
+        for (size_t c = 0; c < cols; c++) {
+            col_sums[c] += row[c];
+            row_sum += row[c];
+            if (row[c] > max_value) {
+                max_value = row[c];
+            }
+        }
+        row_sums[r] = row_sum;
+    }
+}
+
+inline void AddMaskedScalar(int *acc, const int *mask, int value, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += value & mask[i];
+    }
+}
+
+inline int FirstArgMaxScalar(const int *v, size_t n) {
+    int best = 0;
+    int best_idx = -1;
+    for (size_t i = 0; i < n; i++) {
+        if (v[i] > best) {
+            best = v[i];
+            best_idx = static_cast<int>(i);
+        }
+    }
+    return best_idx;
+}
+
+#ifdef DEMAND_KERNELS_X86
+__attribute__((target("avx2"))) inline void AggregateRowsAvx2(const int *m, size_t rows, size_t cols, int *col_sums,
+                                                               int *row_sums, int &max_value) {
+    for (size_t c = 0; c < cols; c++) {
+        col_sums[c] = 0;
+    }
+    __m256i vmax = _mm256_setzero_si256();
+    int tail_max = 0;
+    for (size_t r = 0; r < rows; r++) {
+        const int *row = m + r * cols;
+        __m256i vsum = _mm256_setzero_si256();
+        size_t c = 0;
+        for (; c + 8 <= cols; c += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + c));
+            __m256i *acc = reinterpret_cast<__m256i *>(col_sums + c);
+            _mm256_storeu_si256(acc, _mm256_add_epi32(_mm256_loadu_si256(acc), v));
+            vsum = _mm256_add_epi32(vsum, v);
+            vmax = _mm256_max_epi32(vmax, v);
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(vsum), _mm256_extracti128_si256(vsum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        int row_sum = _mm_cvtsi128_si32(half);
+        for (; c < cols; c++) {
+            col_sums[c] += row[c];
+            row_sum += row[c];
+            if (row[c] > tail_max) {
+                tail_max = row[c];
+            }
+        }
+        row_sums[r] = row_sum;
+    }
+    alignas(32) int lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), vmax);
+    max_value = tail_max;
+    for (int lane : lanes) {
+        if (lane > max_value) {
+            max_value = lane;
+        }
+    }
+}
+
+// SSE2没有32位整数的max，用比较和掩码代替
+inline __m128i MaxEpi32Sse2(__m128i a, __m128i b) {
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+__attribute__((target("sse2"))) inline void AggregateRowsSse2(const int *m, size_t rows, size_t cols, int *col_sums,
+                                                               int *row_sums, int &max_value) {
+    for (size_t c = 0; c < cols; c++) {
+        col_sums[c] = 0;
+    }
+    __m128i vmax = _mm_setzero_si128();
+    int tail_max = 0;
+    for (size_t r = 0; r < rows; r++) {
+        const int *row = m + r * cols;
+        __m128i vsum = _mm_setzero_si128();
+        size_t c = 0;
+        for (; c + 4 <= cols; c += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + c));
+            __m128i *acc = reinterpret_cast<__m128i *>(col_sums + c);
+            _mm_storeu_si128(acc, _mm_add_epi32(_mm_loadu_si128(acc), v));
+            vsum = _mm_add_epi32(vsum, v);
+            vmax = MaxEpi32Sse2(vmax, v);
+        }
+        vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(1, 0, 3, 2)));
+        vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(2, 3, 0, 1)));
+        int row_sum = _mm_cvtsi128_si32(vsum);
+        for (; c < cols; c++) {
+            col_sums[c] += row[c];
+            row_sum += row[c];
+            if (row[c] > tail_max) {
+                tail_max = row[c];
+            }
+        }
+        row_sums[r] = row_sum;
+    }
+    alignas(16) int lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), vmax);
+    max_value = tail_max;
+    for (int lane : lanes) {
+        if (lane > max_value) {
+            max_value = lane;
+        }
+    }
+}
+
+__attribute__((target("avx2"))) inline void AddMaskedAvx2(int *acc, const int *mask, int value, size_t n) {
+    __m256i vv = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask + i));
+        __m256i *a = reinterpret_cast<__m256i *>(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_and_si256(vv, m)));
+    }
+    AddMaskedScalar(acc + i, mask + i, value, n - i);
+}
+
+__attribute__((target("sse2"))) inline void AddMaskedSse2(int *acc, const int *mask, int value, size_t n) {
+    __m128i vv = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask + i));
+        __m128i *a = reinterpret_cast<__m128i *>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_and_si128(vv, m)));
+    }
+    AddMaskedScalar(acc + i, mask + i, value, n - i);
+}
+
+// 先求最大值，再找第一个等于最大值的位置
+__attribute__((target("avx2"))) inline int FirstArgMaxAvx2(const int *v, size_t n) {
+    __m256i vmax = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vmax = _mm256_max_epi32(vmax, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)));
+    }
+    __m128i half = _mm_max_epi32(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1));
+    half = _mm_max_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_max_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int best = _mm_cvtsi128_si32(half);
+    for (size_t j = i; j < n; j++) {
+        if (v[j] > best) {
+            best = v[j];
+        }
+    }
+    if (best <= 0) {
+        return -1;
+    }
+    __m256i vbest = _mm256_set1_epi32(best);
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)), vbest);
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (bits != 0) {
+            return static_cast<int>(i) + __builtin_ctz(bits);
+        }
+    }
+    for (; v[i] != best; i++) {
+    }
+    return static_cast<int>(i);
+}
+
+__attribute__((target("sse2"))) inline int FirstArgMaxSse2(const int *v, size_t n) {
+    __m128i vmax = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vmax = MaxEpi32Sse2(vmax, _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)));
+    }
+    vmax = MaxEpi32Sse2(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+    vmax = MaxEpi32Sse2(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+    int best = _mm_cvtsi128_si32(vmax);
+    for (size_t j = i; j < n; j++) {
+        if (v[j] > best) {
+            best = v[j];
+        }
+    }
+    if (best <= 0) {
+        return -1;
+    }
+    __m128i vbest = _mm_set1_epi32(best);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)), vbest);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (bits != 0) {
+            return static_cast<int>(i) + __builtin_ctz(bits);
+        }
+    }
+    for (; v[i] != best; i++) {
+    }
+    return static_cast<int>(i);
+}
+
+inline bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+} // namespace detail
+
+// 一次遍历rows×cols的矩阵，得到每列的和（每个客户的总需求）、每行的和（每条流的总需求）和最大元素
+// 元素均为非负数，空矩阵的最大元素为0
+inline void AggregateRows(const int *m, size_t rows, size_t cols, int *col_sums, int *row_sums, int &max_value) {
+#ifdef DEMAND_KERNELS_X86
+    if (detail::HasAvx2()) {
+        detail::AggregateRowsAvx2(m, rows, cols, col_sums, row_sums, max_value);
+    } else {
+        detail::AggregateRowsSse2(m, rows, cols, col_sums, row_sums, max_value);
+    }
+#else
+    detail::AggregateRowsScalar(m, rows, cols, col_sums, row_sums, max_value);
+#endif
+}
+
+// acc[i] += value & mask[i]，掩码元素为0或-1，即只在掩码为-1的位置加上value
+inline void AddMasked(int *acc, const int *mask, int value, size_t n) {
+#ifdef DEMAND_KERNELS_X86
+    if (detail::HasAvx2()) {
+        detail::AddMaskedAvx2(acc, mask, value, n);
+    } else {
+        detail::AddMaskedSse2(acc, mask, value, n);
+    }
+#else
+    detail::AddMaskedScalar(acc, mask, value, n);
+#endif
+}
+
+// 第一个最大元素的下标，最大元素不为正时返回-1
+inline int FirstArgMax(const int *v, size_t n) {
+#ifdef DEMAND_KERNELS_X86
+    return detail::HasAvx2() ? detail::FirstArgMaxAvx2(v, n) : detail::FirstArgMaxSse2(v, n);
+#else
+    return detail::FirstArgMaxScalar(v, n);
+#endif
+}
+
+// out(rows×cols) = a(rows×inner) × mask(inner×cols)，mask的元素为0或-1，用与代替乘法
+// 例如剩余需求(流×客户)乘以可达关系(客户×服务器)，得到每条流在每个服务器的客户上的需求之和
+// 按列分块，一块掩码在所有行之间复用；a中为0的元素直接跳过
+inline void MaskedProduct(const int *a, size_t rows, size_t inner, const int *mask, size_t cols, int *out) {
+    const size_t BLOCK = 256;
+    std::fill(out, out + rows * cols, 0);
+    for (size_t col = 0; col < cols; col += BLOCK) {
+        size_t width = std::min(BLOCK, cols - col);
+        for (size_t r = 0; r < rows; r++) {
+            const int *row = a + r * inner;
+            for (size_t k = 0; k < inner; k++) {
+                if (row[k] != 0) {
+                    AddMasked(out + r * cols + col, mask + k * cols + col, row[k], width);
+                }
+            }
+        }
+    }
+}
+
+} // namespace demand_kernels
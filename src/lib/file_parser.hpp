@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "client.hpp"
@@ -15,6 +16,10 @@ using namespace std;
 class FileParser {
   public:
     FileParser() = default;
+    // 从指定目录而不是/data读取输入文件
+    explicit FileParser(const string &data_dir)
+        : site_filename_(data_dir + "/site_bandwidth.csv"), config_filename_(data_dir + "/config.ini"),
+          qos_filename_(data_dir + "/qos.csv"), demand_filename_(data_dir + "/demand.csv") {}
     ~FileParser() {
         if (demand_fp_ != nullptr) {
             fclose(demand_fp_);
@@ -89,10 +94,18 @@ class FileParser {
 
     // 读取下一个时间戳的用户节点的需求
     bool ParseDemand(int client_count, vector<Demand> &demands) {
-        if (demand_fp_ == nullptr) {
-            demand_fp_ = fopen(demand_filename_.c_str(), "r");
-        }
         Demand d;
+        bool ret = ParseDemand(client_count, d);
+        d.BuildSparse();
+        demands.push_back(move(d));
+        return ret;
+    }
+
+    // 只解析下一个时间戳的需求矩阵，不建立稀疏索引，由调用者在其他线程上完成
+    // 返回false表示这是最后一个时间戳
+    bool ParseDemand(int client_count, Demand &d) {
+        OpenDemand();
+        d.client_count_ = client_count;
         string cur_time;
         string cur_stream;
         char buf[30];
@@ -110,30 +123,36 @@ class FileParser {
         }
         bool ret = true;
         while (ret) {
-            int c = fgetc(demand_fp_);
-            if (c == EOF) {
-                ret = false;
-                break;
+            // 上一次调用已经读入了下一个时间戳所在行的时间
+            if (pending_time_.empty()) {
+                int c = fgetc(demand_fp_);
+                if (c == EOF) {
+                    ret = false;
+                    break;
+                }
+                ungetc(c, demand_fp_);
+                fscanf(demand_fp_, "%[^,]", buf);
+                pending_time_ = buf;
             }
-            ungetc(c, demand_fp_);
-            fscanf(demand_fp_, "%[^,]", buf);
             if (cur_time == "") {
-                cur_time = string(buf);
-            } else if (cur_time != string(buf)) {
+                cur_time = pending_time_;
+            } else if (cur_time != pending_time_) {
                 break;
             }
+            pending_time_.clear();
             d.time_ = cur_time;
             fscanf(demand_fp_, ",%[^,]", buf);
             cur_stream = string(buf);
-            d.demands_[cur_stream] = vector<int>(client_count);
+            d.stream_names_.push_back(cur_stream);
+            d.demands_.resize(d.demands_.size() + client_count);
+            int *row = &d.demands_[d.demands_.size() - client_count];
             for (int i = 0; i < client_count; i++) {
                 int tmp;
                 fscanf(demand_fp_, ",%d", &tmp);
-                d.demands_[cur_stream][demand_cli_idx_[i]] = tmp;
+                row[demand_cli_idx_[i]] = tmp;
             }
             fscanf(demand_fp_, "\n");
         }
-        demands.push_back(d);
         return ret;
     }
 
@@ -149,6 +168,29 @@ class FileParser {
         return res;
     }
 
+    void SetDemandFilename(const string &filename) { demand_filename_ = filename; }
+    // 打开需求文件，无法打开时返回false；ParseDemand在第一次调用时也会打开
+    bool OpenDemand() {
+        if (demand_fp_ == nullptr) {
+            demand_fp_ = fopen(demand_filename_.c_str(), "r");
+        }
+        return demand_fp_ != nullptr;
+    }
+    // 检查四个输入文件都可以打开，否则返回false并在unreadable中给出第一个无法打开的文件
+    bool CheckInputs(string &unreadable) const {
+        for (const string *filename : {&config_filename_, &site_filename_, &qos_filename_, &demand_filename_}) {
+            FILE *fp = fopen(filename->c_str(), "r");
+            if (fp == nullptr) {
+                unreadable = *filename;
+                return false;
+            }
+            fclose(fp);
+        }
+        return true;
+    }
+    const unordered_map<string, size_t> &GetSiteNameMap() const { return site_name_map_; }
+    const unordered_map<string, size_t> &GetClientNameMap() const { return client_name_map_; }
+
     void RebuildClientMap(const vector<Client> &clis) {
         for (auto cli : clis) {
             client_name_map_[cli.name_] = cli.id_;
@@ -160,6 +202,7 @@ class FileParser {
     unordered_map<string, size_t> site_name_map_;
     unordered_map<string, size_t> client_name_map_;
     vector<size_t> demand_cli_idx_;
+    string pending_time_;
     string site_filename_{"/data/site_bandwidth.csv"};
     string config_filename_{"/data/config.ini"};
     string qos_filename_{"/data/qos.csv"};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "topology.hpp"
+
+using namespace std;
+
+// 每个客户在自己的服务器槽位上维护一棵最大值线段树，叶子为服务器当前还能接收的流量（由调用者定义），
+// 用于在O(log k)内找到第一个能放下某个需求的槽位。服务器少的客户直接扫描更快，不建索引
+// 要求两次Build之间服务器的值只减不增：树中的值是上界，查询到的叶子过期时才修正，
+// 因此分配流之后不需要更新可以访问该服务器的所有客户
+class FirstFitIndex {
+  public:
+    static constexpr int NONE = INT_MIN;
+
+    // key_of(site_idx)返回服务器的值，不可用的服务器返回NONE；只为至少min_sites个服务器的客户建索引
+    template <typename KeyOf>
+    void Build(const Topology &topology, size_t client_count, size_t min_sites, KeyOf key_of) {
+        topology_ = &topology;
+        leaves_.assign(client_count, 0);
+        offsets_.assign(client_count, 0);
+        size_t total = 0;
+        for (size_t cli_idx = 0; cli_idx < client_count; cli_idx++) {
+            size_t k = topology.GetClientSites(cli_idx).size();
+            if (k < min_sites) {
+                continue;
+            }
+            size_t leaves = 1;
+            while (leaves < k) {
+                leaves <<= 1;
+            }
+            leaves_[cli_idx] = static_cast<uint32_t>(leaves);
+            offsets_[cli_idx] = static_cast<uint32_t>(total);
+            total += 2 * leaves;
+        }
+        tree_.assign(total, int(NONE));
+        for (size_t cli_idx = 0; cli_idx < client_count; cli_idx++) {
+            if (leaves_[cli_idx] == 0) {
+                continue;
+            }
+            int *tree = &tree_[offsets_[cli_idx]];
+            size_t leaves = leaves_[cli_idx];
+            auto sites = topology.GetClientSites(cli_idx);
+            for (size_t slot = 0; slot < sites.size(); slot++) {
+                tree[leaves + slot] = key_of(sites[slot]);
+            }
+            for (size_t node = leaves - 1; node > 0; node--) {
+                tree[node] = max(tree[2 * node], tree[2 * node + 1]);
+            }
+        }
+    }
+    bool IsIndexed(size_t cli_idx) const { return leaves_[cli_idx] != 0; }
+    // 客户的第一个当前值不小于x的槽位，没有时返回-1；key_of与Build时相同
+    template <typename KeyOf>
+    int FindFirst(size_t cli_idx, int x, KeyOf key_of) {
+        int *tree = &tree_[offsets_[cli_idx]];
+        size_t leaves = leaves_[cli_idx];
+        auto sites = topology_->GetClientSites(cli_idx);
+        while (tree[1] >= x) {
+            size_t node = 1;
+            while (node < leaves) {
+                node = tree[2 * node] >= x ? 2 * node : 2 * node + 1;
+            }
+            int key = key_of(sites[node - leaves]);
+            if (key >= x) {
+                return static_cast<int>(node - leaves);
+            }
+            // 叶子已过期，修正后重新查找
+            tree[node] = key;
+            for (node >>= 1; node > 0; node >>= 1) {
+                tree[node] = max(tree[2 * node], tree[2 * node + 1]);
+            }
+        }
+        return -1;
+    }
+
+  private:
+    const Topology *topology_{nullptr};
+    vector<uint32_t> leaves_;  // 每个客户的叶子数，为0表示没有索引
+    vector<uint32_t> offsets_; // 每个客户的树在tree_中的起始位置
+    vector<int> tree_;         // 下标从1开始的完全二叉树，叶子在[leaves, 2 * leaves)
+};
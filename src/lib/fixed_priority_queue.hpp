@@ -6,43 +6,57 @@
 
 /// A priority queue with fixed size. When the maximum size was reached,
 /// the element with the lowest priority would be removed automatically.
+///
+/// Elements are kept in a min-max heap, so both the highest priority element
+/// (returned by top) and the lowest priority one (evicted on overflow) are
+/// reachable in O(1), and push/pop cost O(log k) for a capacity of k.
 template <typename T, typename Compare = std::less<T>>
 class fixed_size_priority_queue {
   public:
     fixed_size_priority_queue() : max_size_(0) {}
-    fixed_size_priority_queue(size_t max_size) : max_size_(max_size) {}
+    fixed_size_priority_queue(size_t max_size) : max_size_(max_size) { c_.reserve(max_size); }
 
     typedef typename std::vector<T>::iterator iterator;
     iterator begin() { return c_.begin(); }
     iterator end() { return c_.end(); }
 
     inline void push(const T &x) {
-        if (c_.size() == max_size_) {
-            typename std::vector<T>::iterator iterator_min =
-                std::min_element(c_.begin(), c_.end(), cmp);
-            if (*iterator_min < x) {
-                *iterator_min = x;
-                std::make_heap(c_.begin(), c_.end(), cmp);
-            }
-        } else {
+        if (max_size_ == 0) {
+            return;
+        }
+        if (c_.size() < max_size_) {
             c_.push_back(x);
-            std::make_heap(c_.begin(), c_.end(), cmp);
+            push_up(c_.size() - 1);
+        } else if (cmp(c_[0], x)) {
+            // replace the lowest priority element
+            c_[0] = x;
+            trickle_down(0);
         }
     }
 
     inline void pop() {
         if (c_.empty())
             return;
-        std::pop_heap(c_.begin(), c_.end(), cmp);
+        size_t idx = top_index();
+        c_[idx] = c_.back();
         c_.pop_back();
+        if (idx < c_.size()) {
+            trickle_down(idx);
+        }
     }
 
-    inline const T &top() const { return c_.front(); }
+    inline const T &top() const { return c_[top_index()]; }
+
+    inline const T &bottom() const { return c_.front(); }
 
     inline const bool empty() const { return c_.empty(); }
 
     inline const size_t size() const { return c_.size(); }
 
+    inline const size_t max_size() const { return max_size_; }
+
+    inline void clear() { c_.clear(); }
+
     inline void enlarge_max_size(size_t max_size) {
         if (max_size_ < max_size)
             max_size_ = max_size;
@@ -51,7 +65,7 @@ class fixed_size_priority_queue {
   protected:
     std::vector<T> c_;
     size_t max_size_;
-    Compare cmp;
+    mutable Compare cmp;
 
   private:
     // heap allocation is not allowed
@@ -59,4 +73,82 @@ class fixed_size_priority_queue {
     void *operator new[](size_t);
     void operator delete(void *);
     void operator delete[](void *);
+
+    // 偶数层为min层，奇数层为max层
+    static bool is_min_level(size_t i) {
+        size_t level = 0;
+        for (++i; i > 1; i >>= 1) {
+            level++;
+        }
+        return level % 2 == 0;
+    }
+
+    // 在min层比较时取较小者，在max层比较时取较大者
+    bool before(size_t a, size_t b, bool min_level) const {
+        return min_level ? cmp(c_[a], c_[b]) : cmp(c_[b], c_[a]);
+    }
+
+    size_t top_index() const {
+        if (c_.size() <= 2) {
+            return c_.size() - 1;
+        }
+        return cmp(c_[1], c_[2]) ? 2 : 1;
+    }
+
+    void push_up(size_t i) {
+        if (i == 0) {
+            return;
+        }
+        size_t parent = (i - 1) / 2;
+        bool min_level = is_min_level(i);
+        if (before(parent, i, min_level)) {
+            std::swap(c_[i], c_[parent]);
+            push_up_level(parent, !min_level);
+        } else {
+            push_up_level(i, min_level);
+        }
+    }
+
+    void push_up_level(size_t i, bool min_level) {
+        while (i > 2) {
+            size_t grandparent = ((i - 1) / 2 - 1) / 2;
+            if (!before(i, grandparent, min_level)) {
+                break;
+            }
+            std::swap(c_[i], c_[grandparent]);
+            i = grandparent;
+        }
+    }
+
+    void trickle_down(size_t i) {
+        bool min_level = is_min_level(i);
+        size_t n = c_.size();
+        for (;;) {
+            size_t first_child = 2 * i + 1;
+            if (first_child >= n) {
+                return;
+            }
+            // 在子结点和孙结点中找到最先出堆的结点
+            size_t m = first_child;
+            size_t candidates[] = {first_child + 1, 2 * first_child + 1, 2 * first_child + 2, 2 * first_child + 3,
+                                   2 * first_child + 4};
+            for (size_t k : candidates) {
+                if (k < n && before(k, m, min_level)) {
+                    m = k;
+                }
+            }
+            if (!before(m, i, min_level)) {
+                return;
+            }
+            std::swap(c_[m], c_[i]);
+            if (m <= first_child + 1) {
+                return;
+            }
+            size_t parent = (m - 1) / 2;
+            if (before(parent, m, min_level)) {
+                std::swap(c_[m], c_[parent]);
+            }
+            i = m;
+        }
+    }
 };
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+
+#include "site.hpp"
+#include "stream.hpp"
+
+using namespace std;
+
+// 成本模型：分配流时是否计入中心结点的成本
+// 在运行时根据config.ini选择一次，作为模板参数传入分配函数，
+// center_cost为0时相关的GetMaxStream查询和乘法在编译期被消除
+struct WithCenterCost {
+    static int Extra(Site &site, const Stream &str, double center_cost) {
+        return static_cast<int>(max(0, str.stream_size - site.GetMaxStream(str.stream_name)) * center_cost);
+    }
+};
+
+struct NoCenterCost {
+    static int Extra(Site &, const Stream &, double) { return 0; }
+};
+
+// PresetMaxSites中处理服务器的顺序
+// 被引用次数多的优先，其次按容量
+struct RefTimesFirstOrder {
+    bool operator()(const Site &l, const Site &r) const {
+        if (l.GetRefTimes() != r.GetRefTimes()) {
+            return l.GetRefTimes() > r.GetRefTimes();
+        }
+        return l.GetTotalBandwidth() > r.GetTotalBandwidth();
+    }
+};
+
+// 容量大的优先
+struct CapacityFirstOrder {
+    bool operator()(const Site &l, const Site &r) const { return l.GetTotalBandwidth() > r.GetTotalBandwidth(); }
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "client.hpp"
+#include "demand.hpp"
+#include "file_parser.hpp"
+#include "site.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// 客户和服务器之间的可达关系中的一个连通分量，下标为原问题中的下标，均按原来的顺序排列
+struct Component {
+    vector<size_t> clients;
+    vector<size_t> sites;
+};
+
+// 解析后的全部输入，加载完成后只读，可以被多个调度策略共享
+struct ProblemInput {
+    // Load中一个汇总任务处理的天数
+    static constexpr size_t LOAD_BATCH_DAYS = 8;
+    int qos_constraint{0};
+    int base_cost{0};
+    double center_cost{0};
+    vector<Site> sites;
+    vector<Client> clients;
+    vector<Demand> demands; // demands all mtimes
+    vector<vector<int>> client_demands;
+
+    // 读取所有输入文件，并确定客户的下标顺序
+    // 需求按流水线读取：调用线程逐天解析，每解析完LOAD_BATCH_DAYS天就把建立稀疏索引和汇总各客户需求的任务
+    // 放入任务池，每天的需求只遍历一次，解析的延迟被汇总掩盖。任务不阻塞，可以在任务池的任务中调用
+    void Load(ThreadPool &pool = ThreadPool::Instance()) {
+        FileParser file_parser;
+        LoadTopology(file_parser);
+        // deque追加元素时不移动已有元素，任务可以持有指针
+        deque<Demand> parsed;
+        deque<vector<int>> totals;
+        atomic<size_t> done{0};
+        size_t batches = 0;
+        auto submit = [&](size_t first, size_t last) {
+            vector<pair<Demand *, vector<int> *>> days;
+            for (size_t day = first; day < last; day++) {
+                days.push_back({&parsed[day], &totals[day]});
+            }
+            pool.Async(
+                [days]() {
+                    vector<int> stream_totals;
+                    int max_demand;
+                    for (const auto &day : days) {
+                        day.first->BuildSparse();
+                        day.first->Aggregate(*day.second, stream_totals, max_demand);
+                    }
+                },
+                done);
+            batches++;
+        };
+        size_t submitted = 0;
+        bool more = true;
+        while (more) {
+            parsed.emplace_back();
+            totals.emplace_back();
+            more = file_parser.ParseDemand(clients.size(), parsed.back());
+            if (parsed.size() - submitted == LOAD_BATCH_DAYS || !more) {
+                submit(submitted, parsed.size());
+                submitted = parsed.size();
+            }
+        }
+        pool.Wait(done, batches);
+        demands.assign(make_move_iterator(parsed.begin()), make_move_iterator(parsed.end()));
+        client_demands.assign(make_move_iterator(totals.begin()), make_move_iterator(totals.end()));
+    }
+
+    // 只读取服务器、配置和qos，需求由调用者继续通过file_parser读取（例如流式调度）
+    void LoadTopology(FileParser &file_parser) {
+        file_parser.ParseSites(sites);
+        file_parser.ParseConfig(qos_constraint, base_cost, center_cost);
+        file_parser.ParseQOS(clients, qos_constraint);
+        // 向服务器中添加客户
+        for (size_t i = 0; i < clients.size(); i++) {
+            for (const auto site_idx : clients[i].GetAccessibleSite()) {
+                sites[site_idx].AddRefClient(i);
+            }
+        }
+        // 对于每一个服务器
+        std::for_each(sites.begin(), sites.end(), [this](Site &site) {
+            // 对服务器中的客户进行排序
+            sort(site.GetRefClients().begin(), site.GetRefClients().end(), [this](int l, int r) {
+                auto GetAvailable = [this](int cli_idx) -> int {
+                    int ret = 0;
+                    for (size_t site_idx : clients[cli_idx].GetAccessibleSite()) {
+                        ret += sites[site_idx].GetTotalBandwidth() / sites[site_idx].GetRefTimes();
+                    }
+                    return ret;
+                };
+                return GetAvailable(l) < GetAvailable(r);
+            });
+        });
+        // 对客户进行排序，客户的顺序决定了需求矩阵的列，因此所有策略共用同一顺序
+        std::sort(clients.begin(), clients.end(),
+                  [](const Client &l, const Client &r) { return l.GetSiteCount() < r.GetSiteCount(); });
+        // std::sort(clients.begin(), clients.end(),
+        //           [this](const Client &l, const Client &r) {
+        //               auto GetAvailable = [this](const Client &cli) -> int {
+        //                   int ret = 0;
+        //                   for (size_t site_idx : cli.GetAccessibleSite()) {
+        //                       ret += sites[site_idx].GetTotalBandwidth() /
+        //                              sites[site_idx].GetRefTimes();
+        //                   }
+        //                   return ret;
+        //               };
+        //               return GetAvailable(l) < GetAvailable(r);
+        //           });
+        // 客户的id为解析时的下标，排序后一次性得到新旧下标的对应关系
+        vector<size_t> new_index(clients.size());
+        for (size_t cli_idx = 0; cli_idx < clients.size(); cli_idx++) {
+            new_index[clients[cli_idx].GetID()] = cli_idx;
+            clients[cli_idx].SetID(cli_idx);
+        }
+        // 对于每一个客户
+        std::for_each(clients.begin(), clients.end(), [this](Client &cli) {
+            // 计算client的可以被提供的量
+            for (auto site_idx : cli.GetAccessibleSite()) {
+                auto &site = sites[site_idx];
+                cli.AddAccessTotal(site.GetTotalBandwidth() / site.GetRefTimes());
+            }
+        });
+        // 排序后需要改变原来服务器和file_parser中对应的下标
+        file_parser.RebuildClientMap(clients);
+        for (auto &site : sites) {
+            site.ResetClientIndex(new_index);
+        }
+    }
+
+    // 用并查集把客户和服务器划分为连通分量，没有客户可以访问的服务器不属于任何分量
+    vector<Component> FindComponents() const {
+        // 客户的下标为[0, clients.size())，服务器的下标向后偏移clients.size()
+        vector<size_t> parent(clients.size() + sites.size());
+        iota(parent.begin(), parent.end(), 0);
+        auto find = [&parent](size_t x) {
+            while (parent[x] != x) {
+                parent[x] = parent[parent[x]];
+                x = parent[x];
+            }
+            return x;
+        };
+        for (size_t cli_idx = 0; cli_idx < clients.size(); cli_idx++) {
+            for (size_t site_idx : clients[cli_idx].GetAccessibleSite()) {
+                parent[find(clients.size() + site_idx)] = find(cli_idx);
+            }
+        }
+        vector<Component> components;
+        vector<size_t> component_of(parent.size(), SIZE_MAX);
+        for (size_t cli_idx = 0; cli_idx < clients.size(); cli_idx++) {
+            size_t root = find(cli_idx);
+            if (component_of[root] == SIZE_MAX) {
+                component_of[root] = components.size();
+                components.emplace_back();
+            }
+            components[component_of[root]].clients.push_back(cli_idx);
+        }
+        for (size_t site_idx = 0; site_idx < sites.size(); site_idx++) {
+            size_t root = find(clients.size() + site_idx);
+            if (component_of[root] != SIZE_MAX) {
+                components[component_of[root]].sites.push_back(site_idx);
+            }
+        }
+        return components;
+    }
+
+    // 只包含一个连通分量的子问题，客户、服务器和可达关系的相对顺序与原问题相同
+    ProblemInput Extract(const Component &comp) const {
+        ProblemInput sub;
+        sub.qos_constraint = qos_constraint;
+        sub.base_cost = base_cost;
+        sub.center_cost = center_cost;
+        vector<size_t> cli_index(clients.size(), SIZE_MAX);
+        vector<size_t> site_index(sites.size(), SIZE_MAX);
+        for (size_t i = 0; i < comp.clients.size(); i++) {
+            cli_index[comp.clients[i]] = i;
+        }
+        for (size_t i = 0; i < comp.sites.size(); i++) {
+            site_index[comp.sites[i]] = i;
+        }
+        for (size_t i = 0; i < comp.sites.size(); i++) {
+            const auto &site = sites[comp.sites[i]];
+            sub.sites.emplace_back(i, site.GetName(), site.GetTotalBandwidth());
+            for (size_t cli_idx : site.GetRefClients()) {
+                sub.sites.back().AddRefClient(cli_index[cli_idx]);
+            }
+        }
+        for (size_t i = 0; i < comp.clients.size(); i++) {
+            const auto &cli = clients[comp.clients[i]];
+            sub.clients.emplace_back(i, cli.GetName());
+            for (size_t site_idx : cli.GetAccessibleSite()) {
+                sub.clients.back().GetAccessibleSite().push_back(site_index[site_idx]);
+            }
+            sub.clients.back().AddAccessTotal(cli.GetAccessTotal());
+            sub.clients.back().Init();
+        }
+        sub.demands.reserve(demands.size());
+        sub.client_demands.resize(demands.size());
+        for (size_t day = 0; day < demands.size(); day++) {
+            sub.demands.push_back(demands[day].Project(comp.clients));
+            for (size_t cli_idx : comp.clients) {
+                sub.client_demands[day].push_back(client_demands[day][cli_idx]);
+            }
+        }
+        return sub;
+    }
+
+    // 读取与demand.csv格式相同的修正文件，替换对应时刻的需求，被修正的天放入changed_days；文件无法打开时返回false
+    bool ApplyCorrections(const string &filename, vector<size_t> &changed_days) {
+        unordered_map<string, size_t> day_map;
+        for (size_t day = 0; day < demands.size(); day++) {
+            day_map[demands[day].GetTime()] = day;
+        }
+        FileParser file_parser;
+        file_parser.SetDemandFilename(filename);
+        if (!file_parser.OpenDemand()) {
+            return false;
+        }
+        file_parser.RebuildClientMap(clients);
+        vector<Demand> corrections;
+        while (file_parser.ParseDemand(clients.size(), corrections))
+            ;
+        changed_days.clear();
+        for (auto &d : corrections) {
+            auto it = day_map.find(d.GetTime());
+            if (it == day_map.end()) {
+                continue;
+            }
+            size_t day = it->second;
+            vector<int> stream_totals;
+            int max_demand;
+            d.Aggregate(client_demands[day], stream_totals, max_demand);
+            demands[day] = move(d);
+            changed_days.push_back(day);
+        }
+        return true;
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// 按非负整数键排序的LSD基数排序，每轮处理8位，只做键的最大值需要的轮数
+// 排序是稳定的；排序用到的缓冲区由对象持有，重复使用时不再分配内存
+template <typename T>
+class RadixSorter {
+  public:
+    // key(item)返回非负整数，descending为true时按键从大到小排列
+    template <typename Key>
+    void Sort(vector<T> &items, Key key, bool descending = false) {
+        size_t n = items.size();
+        keys_.resize(n);
+        uint32_t max_key = 0;
+        for (size_t i = 0; i < n; i++) {
+            keys_[i] = static_cast<uint32_t>(key(items[i]));
+            if (keys_[i] > max_key) {
+                max_key = keys_[i];
+            }
+        }
+        if (descending) {
+            for (size_t i = 0; i < n; i++) {
+                keys_[i] = max_key - keys_[i];
+            }
+        }
+        // 元素很少时计数数组的开销比排序本身大，直接插入排序
+        if (n <= INSERTION_THRESHOLD) {
+            InsertionSort(items);
+            return;
+        }
+        scratch_.resize(n);
+        keys_tmp_.resize(n);
+        for (int shift = 0; shift < 32 && (max_key >> shift) != 0; shift += 8) {
+            size_t count[257] = {0};
+            for (size_t i = 0; i < n; i++) {
+                count[((keys_[i] >> shift) & 0xff) + 1]++;
+            }
+            for (int b = 0; b < 256; b++) {
+                count[b + 1] += count[b];
+            }
+            for (size_t i = 0; i < n; i++) {
+                size_t pos = count[(keys_[i] >> shift) & 0xff]++;
+                keys_tmp_[pos] = keys_[i];
+                scratch_[pos] = move(items[i]);
+            }
+            keys_.swap(keys_tmp_);
+            items.swap(scratch_);
+        }
+    }
+
+  private:
+    static constexpr size_t INSERTION_THRESHOLD = 32;
+    vector<uint32_t> keys_;
+    vector<uint32_t> keys_tmp_;
+    vector<T> scratch_;
+
+    void InsertionSort(vector<T> &items) {
+        for (size_t i = 1; i < items.size(); i++) {
+            uint32_t k = keys_[i];
+            T item = move(items[i]);
+            size_t j = i;
+            for (; j > 0 && keys_[j - 1] > k; j--) {
+                keys_[j] = keys_[j - 1];
+                items[j] = move(items[j - 1]);
+            }
+            keys_[j] = k;
+            items[j] = move(item);
+        }
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "demand.hpp"
+
+using namespace std;
+
+// 某一时刻需求的剩余部分
+// 原始需求不被修改，只用位图记录哪些(流, 客户)已经被分配出去，重置时只需清空位图
+// 同时维护每个客户和每条流剩余的总需求
+class ResidualDemand {
+public:
+  ResidualDemand() = default;
+  explicit ResidualDemand(const Demand &d) { Reset(d); }
+
+  void Reset(const Demand &d) {
+    d_ = &d;
+    // 没有流的一天（例如投影到不含需求的连通分量）不能取第0条流
+    cells_ = d.GetDemandData();
+    client_count_ = d.GetClientCount();
+    consumed_.assign((d.GetStreamCount() * client_count_ + 63) / 64, 0);
+    d.Aggregate(client_left_, stream_left_, max_demand_);
+  }
+  const Demand &GetDemand() const { return *d_; }
+  size_t GetStreamCount() const { return d_->GetStreamCount(); }
+  const string &GetStreamName(size_t s) const { return d_->GetStreamName(s); }
+  bool IsConsumed(size_t s, size_t C) const {
+    size_t cell = s * client_count_ + C;
+    return (consumed_[cell >> 6] >> (cell & 63)) & 1;
+  }
+  // 剩余需求，已分配的返回0
+  int Get(size_t s, size_t C) const {
+    size_t cell = s * client_count_ + C;
+    return ((consumed_[cell >> 6] >> (cell & 63)) & 1) ? 0 : cells_[cell];
+  }
+  // 把剩余需求按流×客户写入out，已分配的为0
+  void CopyRemaining(int *out) const {
+    size_t cells = d_->GetStreamCount() * client_count_;
+    if (cells == 0) {
+      return;
+    }
+    memcpy(out, cells_, cells * sizeof(int));
+    for (size_t w = 0; w < consumed_.size(); w++) {
+      for (uint64_t bits = consumed_[w]; bits != 0; bits &= bits - 1) {
+        out[(w << 6) + __builtin_ctzll(bits)] = 0;
+      }
+    }
+  }
+  // 原始需求中第s条流、第C个客户的非零需求，调用者用IsConsumed跳过已分配的
+  Demand::EntryRange GetStreamEntries(size_t s) const { return d_->GetStreamEntries(s); }
+  Demand::EntryRange GetClientEntries(size_t C) const { return d_->GetClientEntries(C); }
+  void Consume(size_t s, size_t C) {
+    size_t cell = s * client_count_ + C;
+    uint64_t bit = uint64_t(1) << (cell & 63);
+    if (consumed_[cell >> 6] & bit) {
+      return;
+    }
+    consumed_[cell >> 6] |= bit;
+    client_left_[C] -= cells_[cell];
+    stream_left_[s] -= cells_[cell];
+  }
+  // 第C个客户剩余的总需求
+  int GetClientTotal(size_t C) const { return client_left_[C]; }
+  // 第s条流剩余的总需求
+  int GetStreamTotal(size_t s) const { return stream_left_[s]; }
+  // 原始需求中最大的单个需求，不超过服务器容量时不需要逐个检查流是否放得下
+  int GetMaxDemand() const { return max_demand_; }
+
+private:
+  const Demand *d_{nullptr};
+  const int *cells_{nullptr};
+  size_t client_count_{0};
+  vector<uint64_t> consumed_;
+  vector<int> client_left_;
+  vector<int> stream_left_;
+  int max_demand_{0};
+};
@@ -2,14 +2,24 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <limits>
 #include <list>
+#include <numeric>
 #include <set>
 #include <string>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <vector>
 
+#include "carry_chain.hpp"
+#include "checkpoint.hpp"
 #include "client.hpp"
+#include "demand.hpp"
 #include "site.hpp"
+#include "thread_pool.hpp"
 
 using namespace std;
 
@@ -35,8 +45,10 @@ class Result {
     }
     size_t GetClientAccessibleSiteCount(size_t C) const { return cli_tbls_[C].tbl.size(); }
     const list<Stream> &GetAllocationTable(size_t C, size_t S) const { return cli_tbls_[C].tbl[S]; }
+    // 分配到服务器S上的流，迭代器可以传给MoveStream
+    list<Stream> &GetSiteStreams(size_t S) { return site_streams_[S]; }
     // migrate streams from server[From] to other accessible servers
-    int Migrate(size_t from, vector<Site> *sites, vector<pair<int, size_t>> &seps, int base, int base_cost, int day,
+    int Migrate(size_t from, vector<Client> *clis, vector<pair<int, size_t>> &seps, int base, int base_cost, int day,
                 bool isSep, vector<int> &max_acc) {
         int cur_load = site_loads_[from];
         vector<int> moved(max_acc.size(), 0);
@@ -44,7 +56,7 @@ class Result {
         for (auto it = site_streams_[from].begin(); it != site_streams_[from].end();) {
             assert(it->site_idx == from);
             // which client is the stream from
-            auto &cli_ref = sites->at(it->cli_idx).GetRefClients();
+            auto &cli_ref = clis->at(it->cli_idx).GetAccessibleSite();
             int To = -1;
             int min_free = numeric_limits<int>::max();
             /* int max_dec_cost = 0; */
@@ -79,42 +91,6 @@ class Result {
         }
         return cur_load;
     }
-    int ExpelTop5Test(size_t from, int base, vector<pair<int, size_t>> &seps, vector<Client> *clis,
-                      const vector<int> &max_acc) {
-        int cur_load = site_loads_[from];
-        vector<int> all_moved(max_acc.size(), 0);
-        for (auto it = site_streams_[from].begin(); it != site_streams_[from].end();) {
-            assert(it->site_idx == from);
-            // which client is the stream from
-            auto &cli_ref = clis->at(it->cli_idx).GetAccessibleSite();
-            int to = -1;
-            // choose To server to move
-            for (size_t candidate : cli_ref) {
-                if (candidate == from) {
-                    continue;
-                }
-                if (all_moved[candidate] + it->stream_size >= max_acc[candidate]) {
-                    continue;
-                }
-                if (site_loads_[candidate] + it->stream_size <= seps[candidate].first) {
-                    to = candidate;
-                    break;
-                }
-            }
-            // if all other site's load is greater
-            if (to == -1) {
-                it++;
-                continue;
-            }
-            cur_load -= it->stream_size;
-            all_moved[to] += it->stream_size;
-            if (cur_load <= base) {
-                break;
-            }
-        }
-        return cur_load;
-    }
-
     void ExpelTop5(size_t from, int base, vector<pair<int, size_t>> &seps, vector<Client> *clis,
                    const vector<int> &max_acc) {
         vector<int> all_moved(max_acc.size(), 0);
@@ -197,12 +173,45 @@ class Result {
 
     list<Stream>::iterator MoveStream(list<Stream>::iterator &it, size_t from, size_t to) {
         auto &cli_tbl = cli_tbls_[it->cli_idx];
-        cli_tbl.MoveStream(*it, from, to);
+        auto tbl_it = cli_tbl.Find(*it, from);
+        auto tbl_next = cli_tbl.Splice(tbl_it, from, to);
         site_loads_[to] += it->stream_size;
         site_loads_[from] -= it->stream_size;
         it->site_idx = to;
-        site_streams_[to].push_back(*it);
-        return site_streams_[from].erase(it);
+        auto site_it = it;
+        auto site_next = next(it);
+        site_streams_[to].splice(site_streams_[to].end(), site_streams_[from], site_it);
+        if (logging_) {
+            undo_log_.push_back({site_it, site_next, tbl_it, tbl_next, static_cast<uint32_t>(from),
+                                 static_cast<uint32_t>(to)});
+        }
+        return site_next;
+    }
+    int GetSiteLoad(size_t S) const { return site_loads_[S]; }
+
+    // 开始一次试探：之后的MoveStream记入撤销日志，Commit保留，Rollback按相反的顺序撤销，不能嵌套。
+    // AdjustTop5（--optimize）在当天的分配上试探驱逐，负载仍高于分位值时撤销
+    void Begin() {
+        assert(!logging_);
+        undo_log_.clear();
+        logging_ = true;
+    }
+    void Commit() {
+        assert(logging_);
+        undo_log_.clear();
+        logging_ = false;
+    }
+    // 每条流放回原来的服务器和原来的位置，负载和分配表与Begin时完全相同
+    void Rollback() {
+        for (auto it = undo_log_.rbegin(); it != undo_log_.rend(); ++it) {
+            size_t stream_size = it->site_it->stream_size;
+            cli_tbls_[it->site_it->cli_idx].Unsplice(it->tbl_it, it->from, it->to, it->tbl_next);
+            it->site_it->site_idx = it->from;
+            site_streams_[it->from].splice(it->site_next, site_streams_[it->to], it->site_it);
+            site_loads_[it->from] += stream_size;
+            site_loads_[it->to] -= stream_size;
+        }
+        Commit();
     }
 
   private:
@@ -210,6 +219,19 @@ class Result {
     vector<AllocationTable> cli_tbls_;
     vector<int> site_loads_;
     vector<list<Stream>> site_streams_;
+
+    // 一次迁移：两张表中结点原来的后继，撤销时放回后继之前。
+    // 之后的迁移都先撤销，后继一定已经回到原来的位置
+    struct UndoEntry {
+        list<Stream>::iterator site_it;
+        list<Stream>::iterator site_next;
+        list<Stream>::iterator tbl_it;
+        list<Stream>::iterator tbl_next;
+        uint32_t from;
+        uint32_t to;
+    };
+    vector<UndoEntry> undo_log_;
+    bool logging_{false};
 };
 
 // 所有天的客户分配情况
@@ -224,13 +246,58 @@ class ResultSet {
         clis_ = &clis;
         sites_ = &sites;
     }
+    ResultSet(const ResultSet &) = delete;
+    ResultSet &operator=(const ResultSet &) = delete;
+    ~ResultSet() {
+        if (mapped_ != nullptr) {
+            munmap(mapped_, mapped_size_);
+        }
+    }
+    // 将每天的分配保存在内存映射文件中，内存中只保留各服务器的负载，需要在SetResult之前调用
+    // path必须是不存在的文件，创建后立即删除，进程退出时自动回收。失败时返回false，仍然全部保存在内存中
+    bool EnableMappedStorage(const string &path, const vector<Demand> &demands);
+    // 取出某天的结果，使用映射文件时从文件中解码
+    Result &PageIn(size_t day);
+    // 某天的结果使用完毕，使用映射文件时写回修改并释放分配表
+    void PageOut(size_t day, bool modified = true);
     void Migrate();
     void AdjustTop5();
+    // 按服务器并行计算分位值时使用的线程池，为空时在当前线程计算
+    void SetThreadPool(ThreadPool *pool) { pool_ = pool; }
+    // 把[first_day, last_day)的负载和分配追加到检查点的一段中
+    void SaveCheckpoint(checkpoint::Writer &writer, size_t first_day, size_t last_day, const vector<Demand> &demands);
+    // 从检查点的一段中恢复从first_day开始days天的结果，数据不完整时返回false
+    bool LoadCheckpoint(checkpoint::Reader &reader, size_t first_day, size_t days, const vector<Demand> &demands);
     void Reserve(size_t n) { days_result_.reserve(n); }
     void Resize(size_t n) { days_result_.resize(n); }
     void AddResult(Result &&day_res) { days_result_.push_back(day_res); }
-    void SetResult(size_t day, Result &&day_res) { days_result_[day] = move(day_res); }
-    int GetGrade();
+    // 追加一天，只保留各服务器的负载，用于结果已经写出的流式调度
+    void AppendLoads(const Result &day_res) {
+        days_result_.emplace_back();
+        days_result_.back().day_ = day_res.day_;
+        days_result_.back().site_loads_ = day_res.site_loads_;
+    }
+    void SetResult(size_t day, Result &&day_res) {
+        if (!sorted_loads_.empty()) {
+            UpdateSortedLoads(days_result_[day].site_loads_, day_res.site_loads_);
+        }
+        days_result_[day] = move(day_res);
+        PageOut(day);
+    }
+    int GetGrade(bool verbose = true);
+    int GetSiteLoad(size_t day, size_t site_idx) const { return days_result_[day].site_loads_[site_idx]; }
+    // 只修改某天某个服务器的负载（例如遗留流量变化），分配的流不变
+    void SetSiteLoad(size_t day, size_t site_idx, int load) {
+        if (!sorted_loads_.empty()) {
+            UpdateSortedLoad(site_idx, days_result_[day].site_loads_[site_idx], load);
+        }
+        days_result_[day].site_loads_[site_idx] = load;
+    }
+    // 开始增量维护每个服务器排好序的负载，之后SetResult只更新变化的服务器。只在第一次调用时排序，
+    // Migrate和AdjustTop5直接修改当天的负载，之后再调用时重新排序
+    void EnableIncrementalGrade();
+    // 根据增量维护的负载计算成绩，与GetGrade结果相同
+    int GetIncrementalGrade() const;
     ResultSetIter begin() { return days_result_.begin(); }
     ResultSetIter end() { return days_result_.end(); }
 
@@ -246,27 +313,252 @@ class ResultSet {
     vector<list<pair<int, size_t>>> site_migrate_days_;
     // 从95分位值 到 FACTOR * 95分位值
     vector<list<pair<int, size_t>>> site_top5_days_;
-    vector<bool> is_always_empty_;
+    vector<char> is_always_empty_; // 不用vector<bool>，不同服务器可以在不同线程上写
     vector<int> top5gaps_;
+    ThreadPool *pool_{nullptr};
+    // 每个服务器所有天的负载，从小到大排序
+    vector<vector<int>> sorted_loads_;
     int base_{0};
+    // 映射文件中每天一条定长记录：流的个数，之后按客户、槽位的顺序保存(客户, 槽位, 流)，
+    // 最后是各服务器链表中的流依次对应的编码下标
+    const vector<Demand> *demands_{nullptr};
+    uint8_t *mapped_{nullptr};
+    size_t mapped_size_{0};
+    size_t record_size_{0};
+    vector<bool> resident_;
+
+    // 客户和槽位的个数在EnableMappedStorage中检查
+    struct MappedStream {
+        uint16_t cli_idx;
+        uint16_t slot;
+        uint32_t stream;
+    };
+    vector<MappedStream> encode_buf_;
+    vector<uint32_t> site_order_buf_;
+    // EncodeEntries中(客户, 流)对应的编码下标，每个(客户, 流)一天中只分配到一个服务器
+    vector<uint32_t> entry_pos_;
+    // 记录放不下（例如需求被修正后流变多）时返回false，该天保留在内存中
+    bool Encode(size_t day);
+    void Decode(size_t day);
+    // 按客户、槽位的顺序把一天的流编码为(客户, 槽位, 流)，site_order按服务器链表的顺序记录每条流的编码下标，
+    // 解码后两种顺序都与编码前相同。映射文件和检查点共用
+    void EncodeEntries(const Result &res, const Demand &d, vector<MappedStream> &entries,
+                       vector<uint32_t> &site_order);
+    void DecodeEntries(size_t day, const Demand &d, const MappedStream *entries, const uint32_t *site_order,
+                       size_t count);
+
+    // 迁移流时精确维护遗留流量对之后几天负载的影响
+    CarryChain carry_;
+
+    // 一个服务器的95分位值对应的成绩
+    int SiteGrade(size_t site_idx, int sep) const;
+    void BuildCarryChain();
+    // 每个服务器在某天最多还能接收的流量
+    void FillHeadroom(size_t day, vector<int> &max_accept) const;
+    // 某天的负载从origin_loads变化后，更新之后几天的负载
+    void PropagateLoads(size_t day, const vector<int> &origin_loads);
+    void UpdateSortedLoads(const vector<int> &old_loads, const vector<int> &new_loads);
+    void UpdateSortedLoad(size_t site_idx, int old_load, int new_load);
 
     void ComputeAllSeps(ComputeJob job);
     void ComputeSomeSeps(ComputeJob job, size_t site_idx);
 };
 
-inline int ResultSet::GetGrade() {
+inline bool ResultSet::EnableMappedStorage(const string &path, const vector<Demand> &demands) {
+    // 记录长度取决于一天中非零需求最多的个数
+    size_t max_streams = 0;
+    for (const auto &d : demands) {
+        size_t nonzero = 0;
+        for (size_t s = 0; s < d.GetStreamCount(); s++) {
+            const int *row = d.GetStreamDemand(s);
+            for (size_t cli_idx = 0; cli_idx < d.GetClientCount(); cli_idx++) {
+                nonzero += row[cli_idx] != 0;
+            }
+        }
+        max_streams = max(max_streams, nonzero);
+    }
+    size_t max_slots = 0;
+    for (const auto &cli : *clis_) {
+        max_slots = max(max_slots, cli.GetSiteCount());
+    }
+    if (clis_->size() > UINT16_MAX || max_slots > UINT16_MAX || max_streams > UINT32_MAX) {
+        return false;
+    }
+    // 不覆盖已经存在的文件，例如误传的输出文件
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    unlink(path.c_str());
+    record_size_ = sizeof(uint32_t) + max_streams * (sizeof(MappedStream) + sizeof(uint32_t));
+    mapped_size_ = max<size_t>(1, record_size_ * demands.size());
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, mapped_size_) == 0) {
+        p = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    mapped_ = static_cast<uint8_t *>(p);
+    demands_ = &demands;
+    resident_.assign(demands.size(), false);
+    return true;
+}
+
+inline Result &ResultSet::PageIn(size_t day) {
+    if (mapped_ != nullptr && !resident_[day]) {
+        Decode(day);
+        resident_[day] = true;
+    }
+    return days_result_[day];
+}
+
+inline void ResultSet::PageOut(size_t day, bool modified) {
+    if (mapped_ == nullptr) {
+        return;
+    }
+    if (modified && !Encode(day)) {
+        resident_[day] = true;
+        return;
+    }
+    auto &res = days_result_[day];
+    vector<AllocationTable>().swap(res.cli_tbls_);
+    vector<list<Stream>>().swap(res.site_streams_);
+    resident_[day] = false;
+}
+
+inline bool ResultSet::Encode(size_t day) {
+    EncodeEntries(days_result_[day], (*demands_)[day], encode_buf_, site_order_buf_);
+    if (sizeof(uint32_t) + encode_buf_.size() * (sizeof(MappedStream) + sizeof(uint32_t)) > record_size_) {
+        return false;
+    }
+    uint8_t *record = mapped_ + day * record_size_;
+    uint32_t count = encode_buf_.size();
+    memcpy(record, &count, sizeof(count));
+    record += sizeof(uint32_t);
+    memcpy(record, encode_buf_.data(), count * sizeof(MappedStream));
+    memcpy(record + count * sizeof(MappedStream), site_order_buf_.data(), count * sizeof(uint32_t));
+    return true;
+}
+
+inline void ResultSet::Decode(size_t day) {
+    const uint8_t *record = mapped_ + day * record_size_;
+    uint32_t count;
+    memcpy(&count, record, sizeof(count));
+    record += sizeof(uint32_t);
+    DecodeEntries(day, (*demands_)[day], reinterpret_cast<const MappedStream *>(record),
+                  reinterpret_cast<const uint32_t *>(record + count * sizeof(MappedStream)), count);
+}
+
+inline void ResultSet::EncodeEntries(const Result &res, const Demand &d, vector<MappedStream> &entries,
+                                     vector<uint32_t> &site_order) {
+    size_t stream_count = d.GetStreamCount();
+    entry_pos_.resize(res.cli_tbls_.size() * stream_count);
+    entries.clear();
+    for (size_t cli_idx = 0; cli_idx < res.cli_tbls_.size(); cli_idx++) {
+        const auto &tbl = res.cli_tbls_[cli_idx].tbl;
+        for (size_t slot = 0; slot < tbl.size(); slot++) {
+            for (const auto &stream : tbl[slot]) {
+                assert(stream.stream_idx < stream_count);
+                entry_pos_[cli_idx * stream_count + stream.stream_idx] = entries.size();
+                entries.push_back({static_cast<uint16_t>(cli_idx), static_cast<uint16_t>(slot), stream.stream_idx});
+            }
+        }
+    }
+    site_order.clear();
+    for (const auto &streams : res.site_streams_) {
+        for (const auto &stream : streams) {
+            site_order.push_back(entry_pos_[stream.cli_idx * stream_count + stream.stream_idx]);
+        }
+    }
+    assert(site_order.size() == entries.size());
+}
+
+inline void ResultSet::DecodeEntries(size_t day, const Demand &d, const MappedStream *entries,
+                                     const uint32_t *site_order, size_t count) {
+    auto &res = days_result_[day];
+    res.cli_tbls_.resize(clis_->size());
+    for (size_t cli_idx = 0; cli_idx < clis_->size(); cli_idx++) {
+        const auto &cli = clis_->at(cli_idx);
+        res.cli_tbls_[cli_idx].tbl.assign(cli.GetSiteCount(), list<Stream>());
+        res.cli_tbls_[cli_idx].slots = cli.GetAllocationTable().slots;
+    }
+    res.site_streams_.assign(sites_->size(), list<Stream>());
+    auto decode = [this, &d](const MappedStream &e) {
+        size_t site_idx = clis_->at(e.cli_idx).GetSiteIndex(e.slot);
+        return Stream(e.cli_idx, site_idx, d.GetStreamName(e.stream), d.Get(e.stream, e.cli_idx), e.stream);
+    };
+    for (size_t k = 0; k < count; k++) {
+        const auto &e = entries[k];
+        res.cli_tbls_[e.cli_idx].tbl[e.slot].push_back(decode(e));
+    }
+    for (size_t k = 0; k < count; k++) {
+        Stream stream = decode(entries[site_order[k]]);
+        res.site_streams_[stream.site_idx].push_back(stream);
+    }
+}
+
+inline void ResultSet::SaveCheckpoint(checkpoint::Writer &writer, size_t first_day, size_t last_day,
+                                      const vector<Demand> &demands) {
+    vector<int> loads;
+    vector<uint32_t> offsets(1, 0);
+    vector<MappedStream> entries;
+    vector<uint32_t> site_order;
+    for (size_t day = first_day; day < last_day; day++) {
+        const auto &res = PageIn(day);
+        loads.insert(loads.end(), res.site_loads_.begin(), res.site_loads_.end());
+        EncodeEntries(res, demands[day], encode_buf_, site_order_buf_);
+        entries.insert(entries.end(), encode_buf_.begin(), encode_buf_.end());
+        site_order.insert(site_order.end(), site_order_buf_.begin(), site_order_buf_.end());
+        offsets.push_back(entries.size());
+        PageOut(day, false);
+    }
+    writer.Append(loads.data(), loads.size() * sizeof(int));
+    writer.Append(offsets.data(), offsets.size() * sizeof(uint32_t));
+    writer.Append(entries.data(), entries.size() * sizeof(MappedStream));
+    writer.Append(site_order.data(), site_order.size() * sizeof(uint32_t));
+}
+
+inline bool ResultSet::LoadCheckpoint(checkpoint::Reader &reader, size_t first_day, size_t days,
+                                      const vector<Demand> &demands) {
+    size_t site_count = sites_->size();
+    const int *loads = reader.Take<int>(days * site_count);
+    const uint32_t *offsets = reader.Take<uint32_t>(days + 1);
+    if (loads == nullptr || offsets == nullptr) {
+        return false;
+    }
+    const MappedStream *entries = reader.Take<MappedStream>(offsets[days]);
+    const uint32_t *site_order = reader.Take<uint32_t>(offsets[days]);
+    if (entries == nullptr || site_order == nullptr) {
+        return false;
+    }
+    for (size_t k = 0; k < days; k++) {
+        size_t day = first_day + k;
+        auto &res = days_result_[day];
+        res.day_ = day;
+        res.site_loads_.assign(loads + k * site_count, loads + (k + 1) * site_count);
+        DecodeEntries(day, demands[day], entries + offsets[k], site_order + offsets[k], offsets[k + 1] - offsets[k]);
+        PageOut(day);
+    }
+    return true;
+}
+
+inline int ResultSet::GetGrade(bool verbose) {
     ComputeAllSeps(ComputeJob::GET_5);
     int grade = 0;
-    printf("all 95 seperators:\n");
-    int cnt = 0;
-    printf("0: ");
-    for (auto &sep : seps_) {
-        printf("%5d ", sep.first);
-        if (++cnt % 5 == 0) {
-            printf("\n%d: ", cnt);
+    if (verbose) {
+        printf("all 95 seperators:\n");
+        int cnt = 0;
+        printf("0: ");
+        for (auto &sep : seps_) {
+            printf("%5d ", sep.first);
+            if (++cnt % 5 == 0) {
+                printf("\n%d: ", cnt);
+            }
         }
+        printf("\n");
     }
-    printf("\n");
     int total = 0;
     int zero_count = 0;
     for (size_t S = 0; S < seps_.size(); S++) {
@@ -275,28 +567,114 @@ inline int ResultSet::GetGrade() {
             continue;
         }
         total += seps_[S].first;
-        // if (seps_[S].first == 0) {
-        if (seps_[S].first <= base_) {
-            if (seps_[S].first > 0)
-                grade += base_;
-        } else {
-            grade += static_cast<int>(pow(1.0 * (seps_[S].first - base_), 2) / sites_->at(S).GetTotalBandwidth() +
-                                      seps_[S].first);
+        grade += SiteGrade(S, seps_[S].first);
+    }
+    if (verbose) {
+        printf("zeros: %d\n", zero_count);
+        printf("total: %d\n", total);
+    }
+    return grade;
+}
+
+inline int ResultSet::SiteGrade(size_t site_idx, int sep) const {
+    // if (sep == 0) {
+    if (sep <= base_) {
+        return sep > 0 ? base_ : 0;
+    }
+    return static_cast<int>(pow(1.0 * (sep - base_), 2) / sites_->at(site_idx).GetTotalBandwidth() + sep);
+}
+
+inline void ResultSet::EnableIncrementalGrade() {
+    if (!sorted_loads_.empty()) {
+        return;
+    }
+    sorted_loads_.assign(sites_->size(), vector<int>());
+    for (size_t site_idx = 0; site_idx < sites_->size(); site_idx++) {
+        auto &arr = sorted_loads_[site_idx];
+        arr.reserve(days_result_.size());
+        for (const auto &res : days_result_) {
+            arr.push_back(res.site_loads_[site_idx]);
+        }
+        sort(arr.begin(), arr.end());
+    }
+}
+
+inline void ResultSet::UpdateSortedLoads(const vector<int> &old_loads, const vector<int> &new_loads) {
+    for (size_t site_idx = 0; site_idx < sorted_loads_.size(); site_idx++) {
+        UpdateSortedLoad(site_idx, old_loads[site_idx], new_loads[site_idx]);
+    }
+}
+
+inline void ResultSet::UpdateSortedLoad(size_t site_idx, int old_load, int new_load) {
+    if (old_load == new_load) {
+        return;
+    }
+    auto &arr = sorted_loads_[site_idx];
+    // 删除旧值并插入新值，只移动两者之间的元素
+    auto pos = lower_bound(arr.begin(), arr.end(), old_load);
+    assert(pos != arr.end() && *pos == old_load);
+    if (new_load > old_load) {
+        auto to = lower_bound(pos, arr.end(), new_load);
+        move(pos + 1, to, pos);
+        *(to - 1) = new_load;
+    } else {
+        auto to = upper_bound(arr.begin(), pos, new_load);
+        move_backward(to, pos, pos + 1);
+        *to = new_load;
+    }
+}
+
+inline int ResultSet::GetIncrementalGrade() const {
+    assert(!sorted_loads_.empty());
+    int grade = 0;
+    for (size_t site_idx = 0; site_idx < sorted_loads_.size(); site_idx++) {
+        const auto &arr = sorted_loads_[site_idx];
+        if (arr.back() == 0) {
+            continue;
         }
+        size_t sep_idx = ceil(arr.size() * 0.95) - 1;
+        grade += SiteGrade(site_idx, arr[sep_idx]);
     }
-    printf("zeros: %d\n", zero_count);
-    printf("total: %d\n", total);
     return grade;
 }
 
+inline void ResultSet::BuildCarryChain() {
+    carry_.Build(*sites_, days_result_.size(),
+                 [this](size_t day, size_t site_idx) { return days_result_[day].site_loads_[site_idx]; });
+}
+
+inline void ResultSet::FillHeadroom(size_t day, vector<int> &max_accept) const {
+    max_accept.resize(sites_->size());
+    for (size_t site_idx = 0; site_idx < sites_->size(); site_idx++) {
+        max_accept[site_idx] = carry_.GetHeadroom(site_idx, day);
+    }
+}
+
+inline void ResultSet::PropagateLoads(size_t day, const vector<int> &origin_loads) {
+    const auto &cur_loads = days_result_[day].site_loads_;
+    for (size_t site_idx = 0; site_idx < origin_loads.size(); site_idx++) {
+        // 当天的负载已经由Result修改，只需要更新之后的天
+        carry_.Add(site_idx, day, cur_loads[site_idx] - origin_loads[site_idx], [&](size_t d, int load) {
+            if (d != day) {
+                SetSiteLoad(d, site_idx, load);
+            }
+        });
+    }
+}
+
 inline void ResultSet::Migrate() {
+    sorted_loads_.clear();
     ComputeAllSeps(ComputeJob::GET_95);
+    BuildCarryChain();
     vector<size_t> site_indexes(site_migrate_days_.size(), 0);
     for (size_t i = 0; i < site_indexes.size(); i++) {
         site_indexes[i] = i;
     }
     sort(site_indexes.begin(), site_indexes.end(), [this](size_t l, size_t r) {
         auto getval = [this](size_t i) -> double {
+            if (site_migrate_days_[i].empty()) {
+                return 0;
+            }
             long sum = 0;
             for (auto p : site_migrate_days_[i]) {
                 sum += p.first;
@@ -327,42 +705,12 @@ inline void ResultSet::Migrate() {
                 break;
             }
 
-            vector<int> max_accept(sites_->size(), numeric_limits<int>::max());
-            for (int N = 1; N <= 3; N++) {
-                if (day + N >= days_result_.size())
-                    break;
-                auto &next_res = days_result_[day + N];
-                int P = 1;
-                for (size_t k = 0; k < N; k++) {
-                    P *= 20;
-                }
-                for (size_t site_idx = 0; site_idx < sites_->size(); site_idx++) {
-                    assert(next_res.site_loads_[site_idx] <= sites_->at(site_idx).GetTotalBandwidth());
-                    max_accept[site_idx] = min(max_accept[site_idx], P * (sites_->at(site_idx).GetTotalBandwidth() -
-                                                                          next_res.site_loads_[site_idx]));
-                }
-            }
+            vector<int> max_accept;
+            FillHeadroom(day, max_accept);
             auto origin_loads = days_result_[day].site_loads_;
-            cur_used = days_result_[day].Migrate(site_idx, sites_, seps_, base, base_, day, isSep, max_accept);
-            auto cur_loads = days_result_[day].site_loads_;
-            for (size_t site_idx = 0; site_idx < origin_loads.size(); site_idx++) {
-                int change = cur_loads[site_idx] - origin_loads[site_idx];
-                // if (change < -10000) {
-                //     printf("idx = %ld, origin = %d, cur = %d\n", site_idx, origin_loads[site_idx],
-                //     cur_loads[site_idx]); printf("change = %d\n", change);
-                // }
-                for (int N = 1; N <= 3; N++) {
-                    if (day + N >= days_result_.size())
-                        break;
-                    auto &next_res = days_result_[day + N];
-                    int P = 1;
-                    for (size_t k = 0; k < N; k++) {
-                        P *= 20;
-                    }
-                    next_res.site_loads_[site_idx] += (change / P);
-                    assert(next_res.site_loads_[site_idx] <= sites_->at(site_idx).GetTotalBandwidth());
-                }
-            }
+            cur_used = PageIn(day).Migrate(site_idx, clis_, seps_, base, base_, day, isSep, max_accept);
+            PageOut(day);
+            PropagateLoads(day, origin_loads);
             isSep = false;
             if (cur_used >= base) {
                 base = cur_used;
@@ -380,35 +728,22 @@ inline void ResultSet::Migrate() {
 }
 
 inline void ResultSet::AdjustTop5() {
+    sorted_loads_.clear();
     ComputeAllSeps(ComputeJob::GET_5);
-    vector<int> site_indexes(sites_->size(), 0);
-    for (int i = 0; i < sites_->size(); i++) {
-        site_indexes.push_back(i);
-    }
-    std::sort(site_indexes.begin(), site_indexes.end(), [this](size_t l, size_t r) {
-        return site_top5_days_[l] > site_top5_days_[r];
-    });
-    for (int i = 0; i < site_indexes.size() / 3; i++) {
-        int site_idx = site_indexes[i];
+    BuildCarryChain();
+    vector<size_t> site_indexes(sites_->size());
+    iota(site_indexes.begin(), site_indexes.end(), 0);
+    // 前5%的天中负载相差最大的服务器优先
+    std::sort(site_indexes.begin(), site_indexes.end(),
+              [this](size_t l, size_t r) { return top5gaps_[l] > top5gaps_[r]; });
+    for (size_t i = 0; i < site_indexes.size() / 3; i++) {
+        size_t site_idx = site_indexes[i];
         //    }
         //    for (size_t site_idx = 0; site_idx < site_top5_days_.size(); site_idx++) {
         for (auto &p : site_top5_days_[site_idx]) {
-            vector<int> max_accept(sites_->size(), numeric_limits<int>::max());
             size_t day = p.second;
-            for (int N = 1; N <= 3; N++) {
-                if (day + N >= days_result_.size())
-                    break;
-                auto &next_res = days_result_[day + N];
-                int P = 1;
-                for (size_t k = 0; k < N; k++) {
-                    P *= 20;
-                }
-                for (size_t site_idx = 0; site_idx < sites_->size(); site_idx++) {
-                    assert(next_res.site_loads_[site_idx] <= sites_->at(site_idx).GetTotalBandwidth());
-                    max_accept[site_idx] = min(max_accept[site_idx], P * (sites_->at(site_idx).GetTotalBandwidth() -
-                                                                          next_res.site_loads_[site_idx]));
-                }
-            }
+            vector<int> max_accept;
+            FillHeadroom(day, max_accept);
             // for (auto acc : max_accept) {
             //     if (acc < 18888) {
             //         printf("%d ", acc);
@@ -416,29 +751,18 @@ inline void ResultSet::AdjustTop5() {
             // }
             // printf("\n");
             auto origin_loads = days_result_[day].site_loads_;
-            if (days_result_[day].ExpelTop5Test(site_idx, base_, seps_, clis_, max_accept) > seps_[site_idx].first) {
+            auto &day_res = PageIn(day);
+            // 直接在当天的分配上驱逐，负载仍高于分位值时撤销
+            day_res.Begin();
+            day_res.ExpelTop5(site_idx, base_, seps_, clis_, max_accept);
+            if (day_res.GetSiteLoad(site_idx) > seps_[site_idx].first) {
+                day_res.Rollback();
+                PageOut(day, false);
                 continue;
             }
-            days_result_[day].ExpelTop5(site_idx, base_, seps_, clis_, max_accept);
-            auto cur_loads = days_result_[day].site_loads_;
-            for (size_t site_idx = 0; site_idx < origin_loads.size(); site_idx++) {
-                int change = cur_loads[site_idx] - origin_loads[site_idx];
-                // if (change < -10000) {
-                //     printf("idx = %ld, origin = %d, cur = %d\n", site_idx, origin_loads[site_idx],
-                //     cur_loads[site_idx]); printf("change = %d\n", change);
-                // }
-                for (int N = 1; N <= 3; N++) {
-                    if (day + N >= days_result_.size())
-                        break;
-                    auto &next_res = days_result_[day + N];
-                    int P = 1;
-                    for (size_t k = 0; k < N; k++) {
-                        P *= 20;
-                    }
-                    next_res.site_loads_[site_idx] += ceil(1.0 * change / P);
-                    assert(next_res.site_loads_[site_idx] <= sites_->at(site_idx).GetTotalBandwidth());
-                }
-            }
+            day_res.Commit();
+            PageOut(day);
+            PropagateLoads(day, origin_loads);
         }
         // ComputeSomeSeps(ComputeJob::GET_5, site_idx);
         // for (auto &p : site_top5_days_[site_idx]) {
@@ -465,30 +789,32 @@ inline void ResultSet::ComputeAllSeps(ComputeJob job) {
         top5gaps_.resize(site_count, 0);
         fill(top5gaps_.begin(), top5gaps_.end(), 0);
     }
-    is_always_empty_.resize(site_count, false);
-    for (size_t site_idx = 0; site_idx < site_count; site_idx++) {
+    // 迁移之后原来一直为空的服务器可能有了负载，每次重新判断
+    is_always_empty_.assign(site_count, false);
+    size_t days = days_result_.size();
+    // 每个服务器只写自己的分位值和天列表，可以分给不同线程；排序用的数组放在线程的临时内存中
+    auto compute = [this, job, days](size_t site_idx, ScratchArena &arena) {
         // load, day
-        vector<pair<int, size_t>> arr;
-        arr.clear();
-        arr.reserve(days_result_.size());
-        for (size_t day = 0; day < days_result_.size(); day++) {
-            arr.push_back({days_result_[day].site_loads_[site_idx], day});
+        arena.Reset();
+        auto *arr = arena.Allocate<pair<int, size_t>>(days);
+        for (size_t day = 0; day < days; day++) {
+            arr[day] = {days_result_[day].site_loads_[site_idx], day};
         }
-        sort(arr.begin(), arr.end(),
+        sort(arr, arr + days,
              [](const pair<int, size_t> &l, const pair<int, size_t> &r) { return l.first < r.first; });
-        size_t sep_idx = ceil(arr.size() * 0.95) - 1;
+        size_t sep_idx = ceil(days * 0.95) - 1;
         seps_[site_idx] = arr[sep_idx];
-        if (arr.back().first == 0) {
+        if (arr[days - 1].first == 0) {
             is_always_empty_[site_idx] = true;
         }
         // get migrate days
 
         if (job == ComputeJob::GET_95) {
             if (is_always_empty_[site_idx]) {
-                continue;
+                return;
             }
             if (static_cast<int>(arr[sep_idx].first) <= base_) {
-                continue;
+                return;
             }
             for (int i = static_cast<int>(sep_idx); i >= 0; i--) {
                 if (arr[i].first <= base_) {
@@ -498,13 +824,21 @@ inline void ResultSet::ComputeAllSeps(ComputeJob job) {
             }
         } else if (job == ComputeJob::GET_5) {
             if (is_always_empty_[site_idx]) {
-                continue;
+                return;
             }
-            top5gaps_[site_idx] = arr[arr.size()-1].first - arr[sep_idx+1].first;
-            for (size_t i = sep_idx + 1; i < arr.size(); i++) {
+            top5gaps_[site_idx] = arr[days - 1].first - arr[sep_idx + 1].first;
+            for (size_t i = sep_idx + 1; i < days; i++) {
                 site_top5_days_[site_idx].push_back(arr[i]);
             }
         }
+    };
+    if (pool_ == nullptr) {
+        ScratchArena arena;
+        for (size_t site_idx = 0; site_idx < site_count; site_idx++) {
+            compute(site_idx, arena);
+        }
+    } else {
+        pool_->ParallelFor(0, site_count, 4, [this, &compute](size_t site_idx) { compute(site_idx, pool_->GetArena()); });
     }
 }
 
@@ -16,6 +16,17 @@ class Site {
     friend class CenterResult;
 
 public:
+    // 一天调度结束后会影响之后几天调度的状态
+    struct State {
+        int remain_bandwidth; // 决定下一天遗留的流量
+        int seperate;
+        int tem_seperate;
+        bool operator==(const State &rhs) const {
+            return remain_bandwidth == rhs.remain_bandwidth && seperate == rhs.seperate &&
+                   tem_seperate == rhs.tem_seperate;
+        }
+    };
+
     Site() = default;
     Site(size_t id, const string &name, int bandwidth)
             : id_(id), name_(name), total_bandwidth_(bandwidth),
@@ -46,11 +57,29 @@ public:
         remain_bandwidth -= usage;
         assert(remain_bandwidth >= 0);
     }
+    // 前一天的负载为load时，遗留到当天的流量
+    int CarryOver(int load) const { return total_bandwidth_ - static_cast<int>(total_bandwidth_ - load * 0.05); }
+    // Reset之后的剩余带宽，即容量减去前一天遗留的流量
+    int GetBandwidthAfterReset() const { return total_bandwidth_ - CarryOver(GetAllocatedBandwidth()); }
     void Reset() {
-        remain_bandwidth = total_bandwidth_ - GetAllocatedBandwidth() * 0.05;
+        remain_bandwidth = GetBandwidthAfterReset();
         full_this_time_ = false;
-        streams_.clear();
-        stream_max_.clear();
+        pool_.Recycle(streams_);
+        // 只把各条流的最大值清零，之后几天中同名的流直接复用结点；不同的名字积累太多时才真正清空
+        size_t live = 0;
+        for (auto &p : stream_max_) {
+            live += p.second != 0;
+            p.second = 0;
+        }
+        if (stream_max_.size() > 2 * live + 64) {
+            stream_max_.clear();
+        }
+    }
+    State SaveState() const { return {remain_bandwidth, seperate_, tem_seperate}; }
+    void RestoreState(const State &state) {
+        remain_bandwidth = state.remain_bandwidth;
+        seperate_ = state.seperate;
+        tem_seperate = state.tem_seperate;
     }
     void SetMaxFullTimes(int times) { max_full_times_ = times; }
     void IncFullTimes() { cur_full_times_++; }
@@ -78,7 +107,7 @@ public:
         assert(flag == true);
         DecreaseBandwidth(str.stream_size);
         stream_max_[str.stream_name] = max(stream_max_[str.stream_name], str.stream_size);
-        streams_.push_back(str);
+        pool_.Append(streams_, str);
     }
     int GetMaxStream(const string &name) {
         if (!stream_max_.count(name)) {
@@ -96,9 +125,10 @@ public:
         printf("\n");
     }
     const list<Stream> &GetStreams() const { return streams_; }
-    void ResetClientIndex(unordered_map<size_t, size_t> &cli_map) {
+    // new_index[原来的客户下标] = 新的客户下标
+    void ResetClientIndex(const vector<size_t> &new_index) {
         for (auto &cli_idx : ref_clients_) {
-            cli_idx = cli_map[cli_idx];
+            cli_idx = new_index[cli_idx];
         }
     }
 
@@ -117,5 +147,7 @@ private:
     bool full_this_time_{false};
     // client idx | stream name | stream size
     list<Stream> streams_;
+    StreamNodePool pool_;
+    // 流名对应的最大值，为0的项表示当天没有这条流
     unordered_map<string, int> stream_max_;
 };
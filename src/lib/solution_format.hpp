@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// 二进制的列式解文件，内容与solution.txt相同，按本机字节序保存
+// 文件头之后依次为服务器、客户、流名三张名字表（偏移数组+字符），每天的起始下标，
+// 以及所有分配的客户、服务器、流名编号三列；每部分都按8字节对齐，读取时可以直接映射
+// 每天的分配按客户（输出中的顺序）、客户的服务器、分配的先后排列，由此可以还原出文本格式
+namespace solution_format {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t site_count;
+    uint32_t client_count;
+    uint32_t stream_count; // 不同流名的个数
+    uint32_t day_count;
+    uint32_t reserved;
+    uint64_t entry_count;
+};
+
+static const char MAGIC[8] = {'C', 'C', 'S', 'O', 'L', 'B', 'I', 'N'};
+static const uint32_t VERSION = 1;
+
+inline size_t Align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// 按天收集分配，最后一次写出
+class Writer {
+  public:
+    Writer(const vector<string> &site_names, const vector<string> &client_names)
+        : site_names_(site_names), client_names_(client_names) {
+        day_offsets_.push_back(0);
+    }
+    // 当天的一条分配，同一客户的分配需要按输出中的顺序添加，不同客户之间的顺序任意
+    void Add(size_t cli_idx, size_t site_idx, const string &stream_name) {
+        auto it = stream_ids_.find(stream_name);
+        if (it == stream_ids_.end()) {
+            it = stream_ids_.emplace(stream_name, static_cast<uint32_t>(stream_names_.size())).first;
+            stream_names_.push_back(stream_name);
+        }
+        day_.push_back({static_cast<uint16_t>(cli_idx), static_cast<uint16_t>(site_idx), it->second});
+    }
+    // 结束一天，按客户稳定排序后追加到各列
+    void EndDay() {
+        stable_sort(day_.begin(), day_.end(),
+                    [](const Entry &l, const Entry &r) { return l.client < r.client; });
+        for (const auto &e : day_) {
+            clients_.push_back(e.client);
+            sites_.push_back(e.site);
+            streams_.push_back(e.stream);
+        }
+        day_.clear();
+        day_offsets_.push_back(clients_.size());
+    }
+    bool Write(const string &filename) const {
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == nullptr) {
+            return false;
+        }
+        Header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.site_count = site_names_.size();
+        header.client_count = client_names_.size();
+        header.stream_count = stream_names_.size();
+        header.day_count = day_offsets_.size() - 1;
+        header.reserved = 0;
+        header.entry_count = clients_.size();
+        size_t pos = 0;
+        bool ok = WriteBlock(fp, &header, sizeof(header), pos) && WriteNames(fp, site_names_, pos) &&
+                  WriteNames(fp, client_names_, pos) && WriteNames(fp, stream_names_, pos) &&
+                  WriteBlock(fp, day_offsets_.data(), day_offsets_.size() * sizeof(uint64_t), pos) &&
+                  WriteBlock(fp, clients_.data(), clients_.size() * sizeof(uint16_t), pos) &&
+                  WriteBlock(fp, sites_.data(), sites_.size() * sizeof(uint16_t), pos) &&
+                  WriteBlock(fp, streams_.data(), streams_.size() * sizeof(uint32_t), pos);
+        return fclose(fp) == 0 && ok;
+    }
+
+  private:
+    struct Entry {
+        uint16_t client;
+        uint16_t site;
+        uint32_t stream;
+    };
+    vector<string> site_names_;
+    vector<string> client_names_;
+    vector<string> stream_names_;
+    unordered_map<string, uint32_t> stream_ids_;
+    vector<Entry> day_;
+    vector<uint64_t> day_offsets_;
+    vector<uint16_t> clients_;
+    vector<uint16_t> sites_;
+    vector<uint32_t> streams_;
+
+    // 写出一块数据并补齐到8字节，写入不完整时返回false
+    static bool WriteBlock(FILE *fp, const void *data, size_t size, size_t &pos) {
+        static const char zeros[8] = {0};
+        size_t pad = Align8(size) - size;
+        pos += Align8(size);
+        return fwrite(data, 1, size, fp) == size && fwrite(zeros, 1, pad, fp) == pad;
+    }
+    static bool WriteNames(FILE *fp, const vector<string> &names, size_t &pos) {
+        vector<uint32_t> offsets(1, 0);
+        string chars;
+        for (const auto &name : names) {
+            chars += name;
+            offsets.push_back(chars.size());
+        }
+        return WriteBlock(fp, offsets.data(), offsets.size() * sizeof(uint32_t), pos) &&
+               WriteBlock(fp, chars.data(), chars.size(), pos);
+    }
+};
+
+// 映射一个二进制解文件，只读
+class Reader {
+  public:
+    Reader() = default;
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char *>(data_), size_);
+        }
+    }
+    // 文件不存在或格式不对时返回false，各部分都在文件范围内并且下标合法时才返回true
+    bool Open(const string &filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<const char *>(p);
+        header_ = reinterpret_cast<const Header *>(data_);
+        if (memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0 || header_->version != VERSION) {
+            return false;
+        }
+        size_t pos = sizeof(Header);
+        if (!ReadNames(header_->site_count, sites_, pos) || !ReadNames(header_->client_count, clients_, pos) ||
+            !ReadNames(header_->stream_count, streams_, pos)) {
+            return false;
+        }
+        // 每条分配至少占8字节，先排除过大的个数，之后的乘法不会溢出
+        size_t entry_count = header_->entry_count;
+        if (header_->entry_count > size_ ||
+            !Take(day_offsets_, size_t(header_->day_count) + 1, pos) ||
+            !Take(entry_clients_, entry_count, pos) || !Take(entry_sites_, entry_count, pos) ||
+            !Take(entry_streams_, entry_count, pos)) {
+            return false;
+        }
+        // 每天的起始下标不减，并且覆盖所有分配
+        if (day_offsets_[0] != 0 || day_offsets_[header_->day_count] != entry_count) {
+            return false;
+        }
+        for (size_t day = 0; day < header_->day_count; day++) {
+            if (day_offsets_[day] > day_offsets_[day + 1]) {
+                return false;
+            }
+        }
+        for (size_t e = 0; e < entry_count; e++) {
+            if (entry_clients_[e] >= header_->client_count || entry_sites_[e] >= header_->site_count ||
+                entry_streams_[e] >= header_->stream_count) {
+                return false;
+            }
+        }
+        return true;
+    }
+    size_t GetDayCount() const { return header_->day_count; }
+    // 将某天还原为solution.txt中的文本
+    void FormatDay(size_t day, string &out) const {
+        size_t e = day_offsets_[day];
+        size_t end = day_offsets_[day + 1];
+        for (size_t cli_idx = 0; cli_idx < header_->client_count; cli_idx++) {
+            AppendName(clients_, cli_idx, out);
+            out += ':';
+            bool first = true;
+            while (e < end && entry_clients_[e] == cli_idx) {
+                // 同一客户连续的相同服务器为一组
+                size_t site_idx = entry_sites_[e];
+                out += first ? "<" : ",<";
+                AppendName(sites_, site_idx, out);
+                for (; e < end && entry_clients_[e] == cli_idx && entry_sites_[e] == site_idx; e++) {
+                    out += ',';
+                    AppendName(streams_, entry_streams_[e], out);
+                }
+                out += '>';
+                first = false;
+            }
+            out += '\n';
+        }
+    }
+
+  private:
+    struct NameTable {
+        const uint32_t *offsets;
+        const char *chars;
+    };
+    const char *data_{nullptr};
+    size_t size_{0};
+    const Header *header_{nullptr};
+    NameTable sites_{};
+    NameTable clients_{};
+    NameTable streams_{};
+    const uint64_t *day_offsets_{nullptr};
+    const uint16_t *entry_clients_{nullptr};
+    const uint16_t *entry_sites_{nullptr};
+    const uint32_t *entry_streams_{nullptr};
+
+    // 从pos开始取出count个T并跳过对齐，超出文件时返回false，pos不超过size_
+    template <typename T>
+    bool Take(const T *&p, size_t count, size_t &pos) const {
+        if (count > (size_ - pos) / sizeof(T)) {
+            return false;
+        }
+        p = reinterpret_cast<const T *>(data_ + pos);
+        pos = min(size_, pos + Align8(count * sizeof(T)));
+        return true;
+    }
+    // 偏移数组从0开始不减，字符部分在文件范围内
+    bool ReadNames(size_t count, NameTable &table, size_t &pos) {
+        if (!Take(table.offsets, count + 1, pos) || table.offsets[0] != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (table.offsets[i] > table.offsets[i + 1]) {
+                return false;
+            }
+        }
+        return Take(table.chars, table.offsets[count], pos);
+    }
+    static void AppendName(const NameTable &table, size_t idx, string &out) {
+        out.append(table.chars + table.offsets[idx], table.offsets[idx + 1] - table.offsets[idx]);
+    }
+};
+
+} // namespace solution_format
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+// 客户可访问服务器的排序方式
+enum class ClientSiteOrder {
+    REF_TIMES,        // 被引用次数少的服务器优先
+    REF_CLIENTS_NEED, // 引用客户的可用总量大的服务器优先
+};
+
+// 预设打满服务器时处理服务器的顺序
+enum class PresetSiteOrder {
+    REF_TIMES_FIRST, // 被引用次数多的优先，其次按容量
+    CAPACITY_FIRST,  // 容量大的优先
+};
+
+// 预设打满服务器的方法
+enum class PresetPlanner {
+    SEQUENTIAL,  // 按固定顺序逐个服务器选择需求最大的天
+    LAZY_GREEDY, // 所有(服务器, 天)按收益全局选择，收益过期时才重新计算
+};
+
+// 一组调度参数，组合中的每个策略在各自的线程上独立调度
+struct Strategy {
+    ClientSiteOrder client_site_order{ClientSiteOrder::REF_TIMES};
+    PresetSiteOrder preset_site_order{PresetSiteOrder::REF_TIMES_FIRST};
+    PresetPlanner preset_planner{PresetPlanner::SEQUENTIAL};
+    // 每个服务器可以打满的天数占总天数的比例
+    double full_day_ratio{0.05};
+    // 服务器打满当天，临时分位值为base_cost的倍数
+    int full_sep_factor{3};
+    // 逐天调度之后运行AdjustTop5和Migrate，把流从高负载的天迁移到其他服务器
+    bool post_optimize{false};
+};
+
+// 策略组合，第一个为默认策略，不加--portfolio时只运行它
+inline vector<Strategy> DefaultPortfolio() {
+    vector<Strategy> portfolio;
+    for (auto preset_order : {PresetSiteOrder::REF_TIMES_FIRST, PresetSiteOrder::CAPACITY_FIRST}) {
+        for (auto client_order : {ClientSiteOrder::REF_TIMES, ClientSiteOrder::REF_CLIENTS_NEED}) {
+            for (int factor : {3, 5}) {
+                Strategy strategy;
+                strategy.preset_site_order = preset_order;
+                strategy.client_site_order = client_order;
+                strategy.full_sep_factor = factor;
+                portfolio.push_back(strategy);
+            }
+        }
+    }
+    for (int factor : {3, 5}) {
+        Strategy global_plan;
+        global_plan.preset_planner = PresetPlanner::LAZY_GREEDY;
+        global_plan.full_sep_factor = factor;
+        portfolio.push_back(global_plan);
+    }
+    Strategy fewer_full_days;
+    fewer_full_days.full_day_ratio = 0.04;
+    portfolio.push_back(fewer_full_days);
+    return portfolio;
+}
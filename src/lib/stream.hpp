@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <list>
 #include <string>
 using namespace std;
 
@@ -8,11 +10,35 @@ struct Stream {
     size_t site_idx;
     string stream_name;
     int stream_size;
+    // 流在当天需求中的下标，编码分配结果时使用，不参与比较
+    uint32_t stream_idx{NO_INDEX};
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
     Stream() = default;
-    Stream(size_t cli, size_t site, const string &name, int size)
-        : cli_idx(cli), site_idx(site), stream_name(name), stream_size(size) {}
+    Stream(size_t cli, size_t site, const string &name, int size, uint32_t idx = NO_INDEX)
+        : cli_idx(cli), site_idx(site), stream_name(name), stream_size(size), stream_idx(idx) {}
     bool operator==(const Stream &rhs) {
         return ((cli_idx == rhs.cli_idx) && (stream_name == rhs.stream_name) &&
                 (stream_size == rhs.stream_size));
     }
 };
+
+// 回收的链表结点：清空链表时把结点放回这里，追加时优先复用，每天的调度稳定后不再申请内存
+// 复制所在的对象时不复制回收的结点
+class StreamNodePool {
+  public:
+    StreamNodePool() = default;
+    StreamNodePool(const StreamNodePool &) {}
+    StreamNodePool &operator=(const StreamNodePool &) { return *this; }
+    void Recycle(list<Stream> &l) { spare_.splice(spare_.end(), l); }
+    void Append(list<Stream> &l, const Stream &stream) {
+        if (spare_.empty()) {
+            l.push_back(stream);
+            return;
+        }
+        l.splice(l.end(), spare_, spare_.begin());
+        l.back() = stream;
+    }
+
+  private:
+    list<Stream> spare_;
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+// 按字节递增分配的临时内存，Reset之后复用已经申请的内存块，只能存放平凡类型
+class ScratchArena {
+  public:
+    template <typename T>
+    T *Allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        size_t align = alignof(T);
+        while (cur_ < blocks_.size()) {
+            size_t offset = (offset_ + align - 1) / align * align;
+            if (offset + bytes <= blocks_[cur_].size) {
+                offset_ = offset + bytes;
+                return reinterpret_cast<T *>(blocks_[cur_].data.get() + offset);
+            }
+            cur_++;
+            offset_ = 0;
+        }
+        size_t size = max(BLOCK_SIZE, bytes + align);
+        blocks_.push_back({unique_ptr<char[]>(new char[size]), size});
+        size_t offset = (reinterpret_cast<uintptr_t>(blocks_.back().data.get()) + align - 1) / align * align -
+                        reinterpret_cast<uintptr_t>(blocks_.back().data.get());
+        offset_ = offset + bytes;
+        return reinterpret_cast<T *>(blocks_.back().data.get() + offset);
+    }
+    // 释放所有分配，内存块保留给下一次使用
+    void Reset() {
+        cur_ = 0;
+        offset_ = 0;
+    }
+
+  private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    struct Block {
+        unique_ptr<char[]> data;
+        size_t size;
+    };
+    vector<Block> blocks_;
+    size_t cur_{0};
+    size_t offset_{0};
+};
+
+// 所有并行阶段共用的任务池，每个工作线程有自己的任务队列，空闲时从其他队列的另一端窃取任务
+// 等待任务完成的线程会帮忙执行任务，因此任务中可以嵌套调用ParallelFor
+class ThreadPool {
+  public:
+    // threads为包括调用线程在内的线程数，0表示使用所有核；pin为true时把工作线程绑定到各自的核上
+    explicit ThreadPool(size_t threads = 0, bool pin = false) {
+        if (threads == 0) {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+        queues_.resize(threads);
+        for (auto &q : queues_) {
+            q.reset(new Queue());
+        }
+        arenas_.resize(threads);
+        for (size_t i = 1; i < threads; i++) {
+            workers_.emplace_back(&ThreadPool::WorkerLoop, this, i, pin);
+        }
+    }
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // 进程共用的任务池，第一次使用前可以通过Configure设置线程数
+    static ThreadPool &Instance() {
+        static ThreadPool pool(ConfiguredThreads(), ConfiguredPin());
+        return pool;
+    }
+    static void Configure(size_t threads, bool pin) {
+        ConfiguredThreads() = threads;
+        ConfiguredPin() = pin;
+    }
+
+    // 包括调用线程在内的线程数
+    size_t GetWorkerCount() const { return queues_.size(); }
+    // 当前线程在任务池中的编号，不属于任务池的线程为0
+    static size_t CurrentWorker() { return WorkerIndex(); }
+    // 当前线程的临时内存，不属于任务池的线程共用0号，因此同时只应有一个外部线程使用
+    ScratchArena &GetArena() { return arenas_[CurrentWorker()]; }
+
+    // 对[begin, end)中的每个下标调用fn(i)，每次领取grain个连续的下标
+    template <typename Fn>
+    void ParallelFor(size_t begin, size_t end, size_t grain, Fn fn) {
+        if (begin >= end) {
+            return;
+        }
+        grain = max<size_t>(grain, 1);
+        size_t chunks = (end - begin + grain - 1) / grain;
+        size_t tasks = min(chunks, GetWorkerCount());
+        if (tasks <= 1) {
+            for (size_t i = begin; i < end; i++) {
+                fn(i);
+            }
+            return;
+        }
+        atomic<size_t> next{0};
+        atomic<size_t> done{0};
+        auto body = [&]() {
+            for (;;) {
+                size_t chunk = next.fetch_add(1);
+                if (chunk >= chunks) {
+                    break;
+                }
+                size_t last = min(end, begin + (chunk + 1) * grain);
+                for (size_t i = begin + chunk * grain; i < last; i++) {
+                    fn(i);
+                }
+            }
+        };
+        for (size_t t = 1; t < tasks; t++) {
+            Push([&body, &done]() {
+                body();
+                done.fetch_add(1);
+            });
+        }
+        body();
+        // 等待其他线程领取的块完成
+        Wait(done, tasks - 1);
+    }
+
+    // 把fn放入任务池后立即返回，fn完成后done加1；fn中不应阻塞等待，以免占住工作线程
+    template <typename Fn>
+    void Async(Fn fn, atomic<size_t> &done) {
+        Push([fn, &done]() {
+            fn();
+            done.fetch_add(1);
+        });
+    }
+    // 等待done达到count，同时帮忙执行队列中的任务
+    void Wait(const atomic<size_t> &done, size_t count) {
+        size_t self = CurrentWorker();
+        while (done.load() < count) {
+            if (!RunOne(self)) {
+                this_thread::yield();
+            }
+        }
+    }
+
+  private:
+    struct Queue {
+        mutex m;
+        deque<function<void()>> tasks;
+    };
+    vector<unique_ptr<Queue>> queues_;
+    vector<ScratchArena> arenas_;
+    vector<thread> workers_;
+    mutex wake_mutex_;
+    condition_variable wake_;
+    atomic<size_t> pending_{0};
+    atomic<size_t> next_queue_{0};
+    bool stop_{false};
+
+    static size_t &WorkerIndex() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+    static size_t &ConfiguredThreads() {
+        static size_t threads = 0;
+        return threads;
+    }
+    static bool &ConfiguredPin() {
+        static bool pin = false;
+        return pin;
+    }
+
+    void Push(function<void()> task) {
+        // 工作线程放入自己的队列，外部线程轮流放入各个队列
+        size_t q = CurrentWorker();
+        if (q == 0) {
+            q = next_queue_.fetch_add(1) % queues_.size();
+        }
+        {
+            lock_guard<mutex> lock(queues_[q]->m);
+            queues_[q]->tasks.push_back(move(task));
+        }
+        pending_.fetch_add(1);
+        {
+            lock_guard<mutex> lock(wake_mutex_);
+        }
+        wake_.notify_one();
+    }
+
+    // 先取自己队列末尾的任务，没有时从其他队列的开头窃取
+    bool RunOne(size_t self) {
+        function<void()> task;
+        for (size_t k = 0; k < queues_.size() && !task; k++) {
+            auto &q = *queues_[(self + k) % queues_.size()];
+            lock_guard<mutex> lock(q.m);
+            if (q.tasks.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                task = move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        pending_.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    void WorkerLoop(size_t index, bool pin) {
+        WorkerIndex() = index;
+#ifdef __linux__
+        if (pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(index % thread::hardware_concurrency(), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
+        for (;;) {
+            if (RunOne(index)) {
+                continue;
+            }
+            unique_lock<mutex> lock(wake_mutex_);
+            wake_.wait(lock, [this]() { return stop_ || pending_.load() > 0; });
+            if (stop_ && pending_.load() == 0) {
+                return;
+            }
+        }
+    }
+};
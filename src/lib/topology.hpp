@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "client.hpp"
+#include "site.hpp"
+
+using namespace std;
+
+// 客户和服务器之间的可达关系，两个方向都用CSR数组保存，下标用16位整数
+// 在客户和服务器的顺序都确定之后构建一次，之后只读
+class Topology {
+  public:
+    // 连续存放的一段下标，可以直接用于range for
+    struct IndexRange {
+        const uint16_t *first;
+        const uint16_t *last;
+        const uint16_t *begin() const { return first; }
+        const uint16_t *end() const { return last; }
+        size_t size() const { return last - first; }
+        size_t operator[](size_t i) const { return first[i]; }
+    };
+    static constexpr uint16_t NO_SLOT = UINT16_MAX;
+
+    // 按照客户中服务器的顺序和服务器中客户的顺序构建
+    void Build(const vector<Client> &clients, const vector<Site> &sites) {
+        assert(clients.size() < NO_SLOT && sites.size() < NO_SLOT);
+        site_count_ = sites.size();
+        cli_offsets_.assign(1, 0);
+        cli_sites_.clear();
+        slots_.assign(clients.size() * site_count_, uint16_t(NO_SLOT));
+        for (size_t cli_idx = 0; cli_idx < clients.size(); cli_idx++) {
+            const auto &accessible = clients[cli_idx].GetAccessibleSite();
+            for (size_t slot = 0; slot < accessible.size(); slot++) {
+                cli_sites_.push_back(static_cast<uint16_t>(accessible[slot]));
+                slots_[cli_idx * site_count_ + accessible[slot]] = static_cast<uint16_t>(slot);
+            }
+            cli_offsets_.push_back(static_cast<uint32_t>(cli_sites_.size()));
+        }
+        site_offsets_.assign(1, 0);
+        site_clients_.clear();
+        for (const auto &site : sites) {
+            for (size_t cli_idx : site.GetRefClients()) {
+                site_clients_.push_back(static_cast<uint16_t>(cli_idx));
+            }
+            site_offsets_.push_back(static_cast<uint32_t>(site_clients_.size()));
+        }
+    }
+    // 客户可以访问的服务器，顺序即客户中服务器的槽位
+    IndexRange GetClientSites(size_t cli_idx) const {
+        return {cli_sites_.data() + cli_offsets_[cli_idx], cli_sites_.data() + cli_offsets_[cli_idx + 1]};
+    }
+    // 可以访问服务器的客户
+    IndexRange GetSiteClients(size_t site_idx) const {
+        return {site_clients_.data() + site_offsets_[site_idx], site_clients_.data() + site_offsets_[site_idx + 1]};
+    }
+    // 服务器在客户中的槽位，不可达时为NO_SLOT
+    size_t GetSlot(size_t cli_idx, size_t site_idx) const { return slots_[cli_idx * site_count_ + site_idx]; }
+    // 客户的槽位表，以服务器下标索引
+    const uint16_t *GetSlots(size_t cli_idx) const { return slots_.data() + cli_idx * site_count_; }
+
+  private:
+    size_t site_count_{0};
+    vector<uint32_t> cli_offsets_;
+    vector<uint16_t> cli_sites_;
+    vector<uint32_t> site_offsets_;
+    vector<uint16_t> site_clients_;
+    vector<uint16_t> slots_; // [client][site]
+};
@@ -0,0 +1,60 @@
+#include "../lib/carry_chain.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+using namespace std;
+
+// 从每天分配的流量重新计算所有负载，负载超过容量时返回false
+bool recompute(const Site &site, const vector<int> &own, vector<int> &loads) {
+  loads.resize(own.size());
+  for (size_t day = 0; day < own.size(); day++) {
+    loads[day] = own[day] + (day == 0 ? 0 : site.CarryOver(loads[day - 1]));
+    if (loads[day] > site.GetTotalBandwidth()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  mt19937 rng(2022);
+  const size_t days = 50;
+  for (int round = 0; round < 20; round++) {
+    vector<Site> sites = {Site(0, "A", 1000 + rng() % 100000)};
+    const Site &site = sites[0];
+    vector<int> own(days), loads;
+    do {
+      for (auto &v : own) {
+        v = rng() % (site.GetTotalBandwidth() * 9 / 10);
+      }
+    } while (!recompute(site, own, loads));
+    CarryChain chain;
+    chain.Build(sites, days, [&loads](size_t day, size_t) { return loads[day]; });
+    for (int step = 0; step < 200; step++) {
+      // 精确的余量：再多1就会在某天超过容量
+      for (size_t day = 0; day < days; day++) {
+        int headroom = chain.GetHeadroom(0, day);
+        vector<int> tmp;
+        own[day] += headroom;
+        assert(recompute(site, own, tmp));
+        own[day] += 1;
+        assert(!recompute(site, own, tmp));
+        own[day] -= headroom + 1;
+      }
+      size_t day = rng() % days;
+      int delta = static_cast<int>(rng() % (chain.GetHeadroom(0, day) + 1)) - static_cast<int>(rng() % (own[day] + 1));
+      delta = max(delta, -own[day]);
+      own[day] += delta;
+      chain.Add(0, day, delta, [&loads](size_t d, int load) { loads[d] = load; });
+      vector<int> expect;
+      assert(recompute(site, own, expect));
+      assert(loads == expect);
+      for (size_t d = 0; d < days; d++) {
+        assert(chain.GetLoad(0, d) == expect[d]);
+      }
+    }
+  }
+  cout << "carry chain test passed" << endl;
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "../lib/demand_kernels.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <vector>
+using namespace std;
+
+// 各个实现与标量实现的结果必须完全相同，列数覆盖向量宽度的整数倍和余数
+void test_aggregate(size_t rows, size_t cols) {
+  mt19937 rng(rows * 1000 + cols);
+  uniform_int_distribution<int> dist(0, 100000);
+  vector<int> m(rows * cols);
+  for (auto &v : m) {
+    v = rng() % 3 == 0 ? dist(rng) : 0;
+  }
+  vector<int> expect_cols(cols), expect_rows(rows);
+  int expect_max;
+  demand_kernels::detail::AggregateRowsScalar(m.data(), rows, cols, expect_cols.data(), expect_rows.data(),
+                                              expect_max);
+  vector<int> col_sums(cols, -1), row_sums(rows, -1);
+  int max_value = -1;
+  demand_kernels::AggregateRows(m.data(), rows, cols, col_sums.data(), row_sums.data(), max_value);
+  assert(col_sums == expect_cols && row_sums == expect_rows && max_value == expect_max);
+#ifdef DEMAND_KERNELS_X86
+  demand_kernels::detail::AggregateRowsSse2(m.data(), rows, cols, col_sums.data(), row_sums.data(), max_value);
+  assert(col_sums == expect_cols && row_sums == expect_rows && max_value == expect_max);
+  if (demand_kernels::detail::HasAvx2()) {
+    demand_kernels::detail::AggregateRowsAvx2(m.data(), rows, cols, col_sums.data(), row_sums.data(), max_value);
+    assert(col_sums == expect_cols && row_sums == expect_rows && max_value == expect_max);
+  }
+#endif
+}
+
+// 掩码乘积与逐个元素的定义相同；各实现的第一个最大值位置与标量实现相同，包括并列和全不为正的情况
+void test_masked(size_t rows, size_t inner, size_t cols) {
+  mt19937 rng(rows * 1000000 + inner * 1000 + cols);
+  vector<int> a(rows * inner), mask(inner * cols);
+  for (auto &v : a) {
+    v = rng() % 3 == 0 ? static_cast<int>(rng() % 100000) : 0;
+  }
+  for (auto &v : mask) {
+    v = rng() % 2 == 0 ? -1 : 0;
+  }
+  vector<int> out(rows * cols, -1);
+  demand_kernels::MaskedProduct(a.data(), rows, inner, mask.data(), cols, out.data());
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t c = 0; c < cols; c++) {
+      int expect = 0;
+      for (size_t k = 0; k < inner; k++) {
+        expect += mask[k * cols + c] != 0 ? a[r * inner + k] : 0;
+      }
+      assert(out[r * cols + c] == expect);
+    }
+  }
+  vector<int> v(cols);
+  for (int round = 0; round < 20; round++) {
+    for (auto &x : v) {
+      x = static_cast<int>(rng() % 7) - (round % 4 == 0 ? 7 : 3);
+    }
+    int expect = demand_kernels::detail::FirstArgMaxScalar(v.data(), cols);
+    assert(demand_kernels::FirstArgMax(v.data(), cols) == expect);
+#ifdef DEMAND_KERNELS_X86
+    assert(demand_kernels::detail::FirstArgMaxSse2(v.data(), cols) == expect);
+    if (demand_kernels::detail::HasAvx2()) {
+      assert(demand_kernels::detail::FirstArgMaxAvx2(v.data(), cols) == expect);
+    }
+#endif
+  }
+}
+
+int main() {
+  for (size_t rows : {0, 1, 7, 100}) {
+    for (size_t cols : {1, 3, 4, 8, 9, 35, 135}) {
+      test_aggregate(rows, cols);
+      test_masked(rows, 20, cols);
+    }
+  }
+  test_masked(3, 5, 300);
+  cout << "demand kernels test passed" << endl;
+  return 0;
+}
@@ -1,4 +1,7 @@
 #include "../lib/fixed_priority_queue.hpp"
+
+#include <cassert>
+#include <random>
 using namespace std;
 
 class Foo {
@@ -51,6 +54,26 @@ void test(fixed_size_priority_queue<T> &q) {
   cout << endl;
 }
 
+// 与完整排序的结果对比，检查只保留最大的k个元素
+void test_top_k(size_t k, size_t n) {
+  mt19937 rng(k * 131 + n);
+  fixed_size_priority_queue<int> q(k);
+  vector<int> all;
+  for (size_t i = 0; i < n; i++) {
+    int v = rng() % 1000;
+    q.push(v);
+    all.push_back(v);
+  }
+  sort(all.begin(), all.end(), greater<int>());
+  assert(q.size() == min(k, n));
+  for (size_t i = 0; i < min(k, n); i++) {
+    assert(q.bottom() <= q.top());
+    assert(q.top() == all[i]);
+    q.pop();
+  }
+  assert(q.empty());
+}
+
 int main(int argc, char const *argv[]) {
   fixed_size_priority_queue<int> q_simple(5);
   q_simple.push(60);
@@ -97,5 +120,11 @@ int main(int argc, char const *argv[]) {
   cout << endl;
   //test(q_pointer);
 
+  for (size_t k = 0; k <= 40; k++) {
+    test_top_k(k, 0);
+    test_top_k(k, k / 2);
+    test_top_k(k, 1000);
+  }
+
   return 0;
 }
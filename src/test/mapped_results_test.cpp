@@ -0,0 +1,103 @@
+#include "../lib/file_parser.hpp"
+#include "result_fixture.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+using namespace std;
+
+int main() {
+  mt19937 rng(2022);
+  const size_t site_count = 4, client_count = 6, stream_count = 40;
+  FullMesh mesh(site_count, client_count);
+  auto &sites = mesh.sites;
+  auto &clients = mesh.clients;
+
+  // 一个时刻的需求，部分为0
+  string demand_path = "/tmp/mapped_results_test_demand." + to_string(getpid());
+  FILE *fp = fopen(demand_path.c_str(), "w");
+  assert(fp != nullptr);
+  fprintf(fp, "mtime,stream_id");
+  for (size_t c = 0; c < client_count; c++) {
+    fprintf(fp, ",C%zu", c);
+  }
+  fprintf(fp, "\n");
+  for (size_t s = 0; s < stream_count; s++) {
+    fprintf(fp, "t0,s%zu", s);
+    for (size_t c = 0; c < client_count; c++) {
+      fprintf(fp, ",%d", rng() % 4 == 0 ? 0 : static_cast<int>(rng() % 100 + 1));
+    }
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+  FileParser file_parser;
+  file_parser.SetDemandFilename(demand_path);
+  file_parser.RebuildClientMap(clients);
+  vector<Demand> demands;
+  file_parser.ParseDemand(client_count, demands);
+  unlink(demand_path.c_str());
+  const Demand &d = demands[0];
+  assert(d.GetStreamCount() == stream_count);
+
+  // 按随机顺序把每个非零需求分配到随机的服务器，服务器链表的顺序与按客户、槽位的顺序不同
+  vector<pair<size_t, size_t>> cells;
+  for (size_t s = 0; s < stream_count; s++) {
+    for (size_t c = 0; c < client_count; c++) {
+      if (d.Get(s, c) != 0) {
+        cells.push_back({s, c});
+      }
+    }
+  }
+  shuffle(cells.begin(), cells.end(), rng);
+  for (const auto &cell : cells) {
+    size_t site_idx = rng() % site_count;
+    Stream stream(cell.second, site_idx, d.GetStreamName(cell.first), d.Get(cell.first, cell.second),
+                  static_cast<uint32_t>(cell.first));
+    sites[site_idx].AddStream(stream);
+    clients[cell.second].AddStreamBySiteIndex(site_idx, stream);
+  }
+
+  ResultSet results(sites, clients, 0);
+  results.Resize(1);
+  string path = "/tmp/mapped_results_test." + to_string(getpid());
+  assert(results.EnableMappedStorage(path, demands));
+  // 映射文件创建后立即删除
+  assert(access(path.c_str(), F_OK) != 0);
+  results.SetResult(0, Result(0, clients, sites));
+  Snapshot expected = take(results.PageIn(0), site_count, client_count);
+  results.PageOut(0, false);
+  // 只有负载留在内存中，解码后两种顺序都与编码前相同
+  assert(take(results.PageIn(0), site_count, client_count) == expected);
+
+  // 迁移后重新编码，迁移到的服务器链表末尾的流仍然按迁移的顺序解码
+  for (int k = 0; k < 30; k++) {
+    auto &res = results.PageIn(0);
+    size_t from = rng() % site_count;
+    auto &streams = res.GetSiteStreams(from);
+    if (streams.empty()) {
+      continue;
+    }
+    auto it = next(streams.begin(), rng() % streams.size());
+    res.MoveStream(it, from, (from + 1 + rng() % (site_count - 1)) % site_count);
+  }
+  expected = take(results.PageIn(0), site_count, client_count);
+  results.PageOut(0);
+  assert(take(results.PageIn(0), site_count, client_count) == expected);
+
+  // 已经存在的文件不会被覆盖
+  fp = fopen(path.c_str(), "w");
+  fputs("keep", fp);
+  fclose(fp);
+  ResultSet other(sites, clients, 0);
+  other.Resize(1);
+  assert(!other.EnableMappedStorage(path, demands));
+  char buf[8] = {0};
+  fp = fopen(path.c_str(), "r");
+  assert(fgets(buf, sizeof(buf), fp) != nullptr && string(buf) == "keep");
+  fclose(fp);
+  unlink(path.c_str());
+  cout << "mapped results test passed" << endl;
+  return 0;
+}
@@ -0,0 +1,35 @@
+#include "../lib/radix_sort.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <random>
+using namespace std;
+
+// 与std::stable_sort的结果对比，覆盖插入排序和多轮基数排序两种情况
+void test_sort(size_t n, int max_key, bool descending) {
+  mt19937 rng(n * 7 + max_key);
+  uniform_int_distribution<int> dist(0, max_key);
+  vector<pair<size_t, int>> items;
+  for (size_t i = 0; i < n; i++) {
+    items.push_back({i, dist(rng)});
+  }
+  auto expect = items;
+  stable_sort(expect.begin(), expect.end(), [descending](const pair<size_t, int> &l, const pair<size_t, int> &r) {
+    return descending ? l.second > r.second : l.second < r.second;
+  });
+  static RadixSorter<pair<size_t, int>> sorter;
+  sorter.Sort(items, [](const pair<size_t, int> &p) { return p.second; }, descending);
+  assert(items == expect);
+}
+
+int main() {
+  for (size_t n : {0, 1, 5, 32, 33, 100, 1000, 50000}) {
+    for (int max_key : {0, 1, 255, 256, 70000, 1 << 30}) {
+      test_sort(n, max_key, false);
+      test_sort(n, max_key, true);
+    }
+  }
+  cout << "radix sort test passed" << endl;
+  return 0;
+}
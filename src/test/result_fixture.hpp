@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../lib/result_set.hpp"
+#include "../lib/topology.hpp"
+
+#include <cassert>
+#include <string>
+#include <vector>
+using namespace std;
+
+// 每个客户都可以访问所有服务器，槽位与服务器下标相同。客户的槽位指向topology，构造后不能复制
+struct FullMesh {
+  vector<Site> sites;
+  vector<Client> clients;
+  Topology topology;
+
+  FullMesh(size_t site_count, size_t client_count) {
+    for (size_t s = 0; s < site_count; s++) {
+      sites.emplace_back(s, "S" + to_string(s), 1 << 30);
+    }
+    for (size_t c = 0; c < client_count; c++) {
+      clients.emplace_back(c, "C" + to_string(c));
+      for (size_t s = 0; s < site_count; s++) {
+        clients[c].GetAccessibleSite().push_back(s);
+        sites[s].AddRefClient(c);
+      }
+      clients[c].Init();
+    }
+    topology.Build(clients, sites);
+    for (size_t c = 0; c < client_count; c++) {
+      clients[c].BindSlots(topology.GetSlots(c));
+    }
+  }
+  FullMesh(const FullMesh &) = delete;
+  FullMesh &operator=(const FullMesh &) = delete;
+};
+
+// 一天分配的完整快照：每个服务器的负载和流的顺序，每个客户每个槽位中流的顺序
+struct Snapshot {
+  vector<int> loads;
+  vector<vector<string>> site_streams;
+  vector<vector<string>> cli_streams;
+
+  bool operator==(const Snapshot &r) const {
+    return loads == r.loads && site_streams == r.site_streams && cli_streams == r.cli_streams;
+  }
+};
+
+// 同时检查每条流记录的服务器与所在的链表一致
+inline Snapshot take(Result &res, size_t site_count, size_t client_count) {
+  Snapshot snap;
+  for (size_t s = 0; s < site_count; s++) {
+    snap.loads.push_back(res.GetSiteLoad(s));
+    snap.site_streams.emplace_back();
+    for (const auto &str : res.GetSiteStreams(s)) {
+      assert(str.site_idx == s);
+      snap.site_streams.back().push_back(str.stream_name + "@" + to_string(str.cli_idx) + ":" +
+                                         to_string(str.stream_size));
+    }
+  }
+  for (size_t c = 0; c < client_count; c++) {
+    for (size_t slot = 0; slot < res.GetClientAccessibleSiteCount(c); slot++) {
+      snap.cli_streams.emplace_back();
+      for (const auto &str : res.GetAllocationTable(c, slot)) {
+        assert(str.site_idx == slot);
+        snap.cli_streams.back().push_back(str.stream_name + ":" + to_string(str.stream_size));
+      }
+    }
+  }
+  return snap;
+}
@@ -0,0 +1,53 @@
+#include "result_fixture.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+using namespace std;
+
+int main() {
+  mt19937 rng(2022);
+  const size_t site_count = 4, client_count = 6;
+  FullMesh mesh(site_count, client_count);
+  auto &sites = mesh.sites;
+  auto &clients = mesh.clients;
+  for (size_t i = 0; i < 200; i++) {
+    Stream stream(rng() % client_count, rng() % site_count, "s" + to_string(i), static_cast<int>(rng() % 100 + 1));
+    sites[stream.site_idx].AddStream(stream);
+    clients[stream.cli_idx].AddStreamBySiteIndex(stream.site_idx, stream);
+  }
+  Result res(0, clients, sites);
+
+  // 随机迁移若干条流，每次从某个服务器的随机位置取一条
+  auto random_moves = [&](int n) {
+    for (int k = 0; k < n; k++) {
+      size_t from = rng() % site_count;
+      auto &streams = res.GetSiteStreams(from);
+      if (streams.empty()) {
+        continue;
+      }
+      auto it = next(streams.begin(), rng() % streams.size());
+      res.MoveStream(it, from, (from + 1 + rng() % (site_count - 1)) % site_count);
+    }
+  };
+  for (int round = 0; round < 100; round++) {
+    Snapshot before = take(res, site_count, client_count);
+    res.Begin();
+    random_moves(rng() % 50);
+    if (round % 2 == 0) {
+      res.Rollback();
+      assert(take(res, site_count, client_count) == before);
+    } else {
+      res.Commit();
+    }
+  }
+  // 提交后不再记录，之前的状态不受影响
+  Snapshot committed = take(res, site_count, client_count);
+  res.Begin();
+  res.Commit();
+  res.Begin();
+  res.Rollback();
+  assert(take(res, site_count, client_count) == committed);
+  cout << "result undo test passed" << endl;
+  return 0;
+}
@@ -0,0 +1,446 @@
+// 核心数据结构的微基准
+// 用法: microbench [--sizes 64,1024,16384] [--filter 名称子串] [--min-time 毫秒] [--save 文件] [--baseline 文件]
+// 每个用例按给定的规模运行，至少运行min-time毫秒，报告每次操作的耗时、内存分配次数和吞吐量。
+// --save把结果保存为基线，--baseline读取之前保存的基线并打印变化，用于判断数据结构修改的效果。
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "client.hpp"
+#include "file_parser.hpp"
+#include "fixed_priority_queue.hpp"
+#include "result_set.hpp"
+#include "site.hpp"
+#include "topology.hpp"
+
+using namespace std;
+
+// 统计计时区间内的内存分配次数；不内联，避免编译器把malloc和free配对检查时误报
+static atomic<size_t> g_alloc_count{0};
+
+__attribute__((noinline)) void *operator new(size_t size) {
+    g_alloc_count.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { operator delete(p); }
+
+// 一个用例在一种规模下的结果
+struct BenchResult {
+    string name;
+    size_t size;
+    double ns_per_op;
+    double allocs_per_op;
+    double throughput; // 每秒处理的单位数
+    string unit;
+};
+
+class BenchRunner {
+  public:
+    BenchRunner(const string &filter, double min_time_ms) : filter_(filter), min_time_ms_(min_time_ms) {}
+    // setup在每轮计时之前调用，不计入耗时和分配次数；body每轮完成ops次操作、处理items个单位
+    void Run(const string &name, size_t size, size_t ops, double items, const string &unit,
+             const function<void()> &setup, const function<void()> &body) {
+        if (!filter_.empty() && name.find(filter_) == string::npos) {
+            return;
+        }
+        double elapsed_ns = 0;
+        size_t allocs = 0;
+        size_t rounds = 0;
+        // 预热一轮，避免首次分配缓冲区的开销计入结果
+        setup();
+        body();
+        while (rounds == 0 || elapsed_ns < min_time_ms_ * 1e6) {
+            setup();
+            size_t alloc_start = g_alloc_count.load(memory_order_relaxed);
+            auto start = chrono::steady_clock::now();
+            body();
+            auto end = chrono::steady_clock::now();
+            allocs += g_alloc_count.load(memory_order_relaxed) - alloc_start;
+            elapsed_ns += chrono::duration<double, nano>(end - start).count();
+            rounds++;
+        }
+        BenchResult r;
+        r.name = name;
+        r.size = size;
+        r.ns_per_op = elapsed_ns / (static_cast<double>(rounds) * ops);
+        r.allocs_per_op = static_cast<double>(allocs) / (static_cast<double>(rounds) * ops);
+        r.throughput = items * rounds / (elapsed_ns * 1e-9);
+        r.unit = unit;
+        results_.push_back(r);
+        Print(r);
+    }
+    const vector<BenchResult> &GetResults() const { return results_; }
+
+    static void PrintHeader() {
+        printf("%-34s %8s %12s %10s %16s\n", "benchmark", "size", "ns/op", "allocs/op", "throughput");
+    }
+    static void Print(const BenchResult &r) {
+        double value = r.throughput;
+        const char *scale = "";
+        if (value >= 1e9) {
+            value /= 1e9;
+            scale = "G";
+        } else if (value >= 1e6) {
+            value /= 1e6;
+            scale = "M";
+        } else if (value >= 1e3) {
+            value /= 1e3;
+            scale = "K";
+        }
+        printf("%-34s %8zu %12.1f %10.2f %9.2f %s%s/s\n", r.name.c_str(), r.size, r.ns_per_op, r.allocs_per_op, value,
+               scale, r.unit.c_str());
+        fflush(stdout);
+    }
+
+  private:
+    string filter_;
+    double min_time_ms_;
+    vector<BenchResult> results_;
+};
+
+// 基线文件每行一个结果：名称 规模 ns/op allocs/op
+bool SaveBaseline(const string &filename, const vector<BenchResult> &results) {
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    for (const auto &r : results) {
+        fprintf(fp, "%s %zu %.3f %.4f\n", r.name.c_str(), r.size, r.ns_per_op, r.allocs_per_op);
+    }
+    fclose(fp);
+    return true;
+}
+
+void CompareBaseline(const string &filename, const vector<BenchResult> &results) {
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (fp == nullptr) {
+        printf("cannot open baseline %s\n", filename.c_str());
+        return;
+    }
+    map<pair<string, size_t>, pair<double, double>> baseline;
+    char name[128];
+    size_t size;
+    double ns;
+    double allocs;
+    while (fscanf(fp, "%127s %zu %lf %lf", name, &size, &ns, &allocs) == 4) {
+        baseline[{name, size}] = {ns, allocs};
+    }
+    fclose(fp);
+    printf("\ncompared with %s:\n", filename.c_str());
+    printf("%-34s %8s %12s %12s %8s %10s %10s\n", "benchmark", "size", "base ns/op", "ns/op", "change", "base allocs",
+           "allocs");
+    for (const auto &r : results) {
+        auto it = baseline.find({r.name, r.size});
+        if (it == baseline.end()) {
+            printf("%-34s %8zu %12s %12.1f %8s\n", r.name.c_str(), r.size, "-", r.ns_per_op, "new");
+            continue;
+        }
+        double base_ns = it->second.first;
+        double change = base_ns > 0 ? (r.ns_per_op - base_ns) / base_ns * 100 : 0;
+        printf("%-34s %8zu %12.1f %12.1f %+7.1f%% %10.2f %10.2f\n", r.name.c_str(), r.size, base_ns, r.ns_per_op,
+               change, it->second.second, r.allocs_per_op);
+    }
+}
+
+// 流名较短，与比赛数据一致，不会超出string的内联缓冲区
+string StreamName(size_t i) { return "s" + to_string(i); }
+
+void BenchPriorityQueue(BenchRunner &runner, size_t n) {
+    // 容量为n，推入4n个随机元素后全部弹出
+    mt19937 rng(1);
+    vector<int> values(4 * n);
+    for (auto &v : values) {
+        v = static_cast<int>(rng() % 1000000);
+    }
+    fixed_size_priority_queue<int> q(n);
+    runner.Run("fixed_pq/push+pop", n, values.size() + n, static_cast<double>(values.size() + n), "op",
+               [&q]() { q.clear(); },
+               [&q, &values]() {
+                   for (int v : values) {
+                       q.push(v);
+                   }
+                   while (!q.empty()) {
+                       q.pop();
+                   }
+               });
+}
+
+void BenchAllocationTableMove(BenchRunner &runner, size_t n) {
+    // 一个客户可以访问两个服务器，n条流按随机顺序从0号移到1号再移回
+    vector<uint16_t> slots = {0, 1};
+    AllocationTable tbl;
+    tbl.tbl.resize(2);
+    tbl.slots = slots.data();
+    vector<Stream> streams;
+    for (size_t i = 0; i < n; i++) {
+        streams.emplace_back(0, 0, StreamName(i), static_cast<int>(i % 100 + 1));
+        tbl.Add(0, streams.back());
+    }
+    mt19937 rng(2);
+    shuffle(streams.begin(), streams.end(), rng);
+    runner.Run("AllocationTable::MoveStream", n, 2 * n, 2.0 * n, "op", []() {},
+               [&tbl, &streams]() {
+                   for (const auto &s : streams) {
+                       tbl.MoveStream(s, 0, 1);
+                   }
+                   for (const auto &s : streams) {
+                       tbl.MoveStream(s, 1, 0);
+                   }
+               });
+}
+
+// 每个客户都可以访问所有服务器的拓扑
+struct FullTopology {
+    vector<Site> sites;
+    vector<Client> clients;
+    Topology topology;
+
+    FullTopology(size_t site_count, size_t client_count) {
+        for (size_t s = 0; s < site_count; s++) {
+            sites.emplace_back(s, "S" + to_string(s), 1 << 30);
+        }
+        for (size_t c = 0; c < client_count; c++) {
+            clients.emplace_back(c, "C" + to_string(c));
+            for (size_t s = 0; s < site_count; s++) {
+                clients[c].GetAccessibleSite().push_back(s);
+                sites[s].AddRefClient(c);
+            }
+            clients[c].Init();
+        }
+        topology.Build(clients, sites);
+        for (size_t c = 0; c < client_count; c++) {
+            clients[c].BindSlots(topology.GetSlots(c));
+        }
+    }
+};
+
+void BenchResultMove(BenchRunner &runner, size_t n) {
+    // 10个客户的n条流都在0号服务器上，全部移到1号再移回
+    const size_t client_count = 10;
+    FullTopology topo(2, client_count);
+    for (size_t i = 0; i < n; i++) {
+        Stream stream(i % client_count, 0, StreamName(i), static_cast<int>(i % 100 + 1));
+        topo.sites[0].AddStream(stream);
+        topo.clients[stream.cli_idx].AddStreamBySiteIndex(0, stream);
+    }
+    Result res(0, topo.clients, topo.sites);
+    auto move_all = [&res](size_t from, size_t to) {
+        auto &streams = res.GetSiteStreams(from);
+        for (auto it = streams.begin(); it != streams.end();) {
+            it = res.MoveStream(it, from, to);
+        }
+    };
+    runner.Run("Result::MoveStream", n, 2 * n, 2.0 * n, "op", []() {},
+               [&move_all]() {
+                   move_all(0, 1);
+                   move_all(1, 0);
+               });
+}
+
+void BenchSite(BenchRunner &runner, size_t n) {
+    // n条流，流名有n/4种，与一天中同名的流分属不同客户的情况类似
+    Site site(0, "S0", 1 << 30);
+    site.AddRefClient(0);
+    vector<Stream> streams;
+    for (size_t i = 0; i < n; i++) {
+        streams.emplace_back(0, 0, StreamName(i % max<size_t>(n / 4, 1)), static_cast<int>(i % 100 + 1));
+    }
+    runner.Run("Site::AddStream", n, n, static_cast<double>(n), "op", [&site]() { site.Reset(); },
+               [&site, &streams]() {
+                   for (const auto &s : streams) {
+                       site.AddStream(s);
+                   }
+               });
+    long sink = 0;
+    runner.Run("Site::GetMaxStream", n, n, static_cast<double>(n), "op", []() {},
+               [&site, &streams, &sink]() {
+                   for (const auto &s : streams) {
+                       sink += site.GetMaxStream(s.stream_name);
+                   }
+               });
+    if (sink == 42) {
+        printf("\n");
+    }
+}
+
+// 生成n条流、若干天的输入文件，返回demand.csv的字节数
+long WriteDemandInput(const string &dir, size_t n, size_t days, size_t client_count) {
+    FILE *fp = fopen((dir + "/site_bandwidth.csv").c_str(), "w");
+    fprintf(fp, "site_name,bandwidth\nS0,1000000\n");
+    fclose(fp);
+    fp = fopen((dir + "/qos.csv").c_str(), "w");
+    fprintf(fp, "site_name");
+    for (size_t c = 0; c < client_count; c++) {
+        fprintf(fp, ",C%zu", c);
+    }
+    fprintf(fp, "\nS0");
+    for (size_t c = 0; c < client_count; c++) {
+        fprintf(fp, ",100");
+    }
+    fprintf(fp, "\n");
+    fclose(fp);
+    fp = fopen((dir + "/config.ini").c_str(), "w");
+    fprintf(fp, "[config]\nqos_constraint=400\nbase_cost=400\ncenter_cost=0.002\n");
+    fclose(fp);
+    fp = fopen((dir + "/demand.csv").c_str(), "w");
+    fprintf(fp, "mtime,stream_id");
+    for (size_t c = 0; c < client_count; c++) {
+        fprintf(fp, ",C%zu", c);
+    }
+    fprintf(fp, "\n");
+    mt19937 rng(3);
+    for (size_t day = 0; day < days; day++) {
+        for (size_t s = 0; s < n; s++) {
+            fprintf(fp, "2021-11-01T%02zu:%02zu,%s", day / 60, day % 60, StreamName(s).c_str());
+            for (size_t c = 0; c < client_count; c++) {
+                fprintf(fp, ",%d", rng() % 3 == 0 ? 0 : static_cast<int>(rng() % 20000));
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    long bytes = ftell(fp);
+    fclose(fp);
+    return bytes;
+}
+
+void BenchParseDemand(BenchRunner &runner, size_t n) {
+    // 每天n条流，总行数约为64K行
+    const size_t client_count = 35;
+    size_t days = max<size_t>(2, 65536 / n);
+    char dir[] = "/tmp/microbench.XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        printf("cannot create temporary directory\n");
+        return;
+    }
+    long bytes = WriteDemandInput(dir, n, days, client_count);
+    unique_ptr<FileParser> parser;
+    vector<Site> sites;
+    vector<Client> clients;
+    vector<Demand> demands;
+    auto setup = [&]() {
+        parser.reset(new FileParser(dir));
+        sites.clear();
+        clients.clear();
+        demands.clear();
+        int qos_constraint;
+        int base_cost;
+        double center_cost;
+        parser->ParseSites(sites);
+        parser->ParseConfig(qos_constraint, base_cost, center_cost);
+        parser->ParseQOS(clients, qos_constraint);
+        demands.reserve(days + 1);
+    };
+    runner.Run("FileParser::ParseDemand", n, days * n, static_cast<double>(bytes), "B", setup,
+               [&parser, &clients, &demands]() {
+                   while (parser->ParseDemand(clients.size(), demands))
+                       ;
+               });
+    parser.reset();
+    for (const char *f : {"site_bandwidth.csv", "qos.csv", "config.ini", "demand.csv"}) {
+        unlink((string(dir) + "/" + f).c_str());
+    }
+    rmdir(dir);
+}
+
+void BenchComputeAllSeps(BenchRunner &runner, size_t n) {
+    // 128个服务器n天的负载，GetGrade的耗时主要是ComputeAllSeps中每个服务器的排序
+    const size_t site_count = 128;
+    FullTopology topo(site_count, 1);
+    ResultSet results(topo.sites, topo.clients, 400);
+    results.Resize(n);
+    mt19937 rng(4);
+    for (size_t day = 0; day < n; day++) {
+        for (auto &site : topo.sites) {
+            site.SetTotalBandwidth(1 << 30);
+            site.DecreaseBandwidth(static_cast<int>(rng() % 400000));
+        }
+        results.SetResult(day, Result(day, topo.clients, topo.sites));
+    }
+    int sink = 0;
+    runner.Run("ResultSet::ComputeAllSeps", n, 1, static_cast<double>(site_count * n), "load", []() {},
+               [&results, &sink]() { sink += results.GetGrade(false); });
+    if (sink == 42) {
+        printf("\n");
+    }
+}
+
+vector<size_t> ParseSizes(const string &s) {
+    vector<size_t> sizes;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == string::npos) {
+            comma = s.size();
+        }
+        sizes.push_back(strtoul(s.substr(pos, comma - pos).c_str(), nullptr, 10));
+        pos = comma + 1;
+    }
+    return sizes;
+}
+
+int main(int argc, char *argv[]) {
+    vector<size_t> sizes = {64, 1024, 16384};
+    string filter;
+    double min_time_ms = 200;
+    string save_file;
+    string baseline_file;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return 2;
+        }
+        if (arg == "--sizes") {
+            sizes = ParseSizes(argv[++i]);
+        } else if (arg == "--filter") {
+            filter = argv[++i];
+        } else if (arg == "--min-time") {
+            min_time_ms = atof(argv[++i]);
+        } else if (arg == "--save") {
+            save_file = argv[++i];
+        } else if (arg == "--baseline") {
+            baseline_file = argv[++i];
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    BenchRunner runner(filter, min_time_ms);
+    BenchRunner::PrintHeader();
+    for (size_t n : sizes) {
+        if (n == 0) {
+            continue;
+        }
+        BenchPriorityQueue(runner, n);
+        BenchAllocationTableMove(runner, n);
+        BenchResultMove(runner, n);
+        BenchSite(runner, n);
+        BenchParseDemand(runner, n);
+        BenchComputeAllSeps(runner, n);
+    }
+    if (!baseline_file.empty()) {
+        CompareBaseline(baseline_file, runner.GetResults());
+    }
+    if (!save_file.empty() && !SaveBaseline(save_file, runner.GetResults())) {
+        printf("cannot write baseline %s\n", save_file.c_str());
+        return 1;
+    }
+    return 0;
+}
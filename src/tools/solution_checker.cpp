@@ -0,0 +1,317 @@
+// 独立的解校验与评分工具
+// 用法: solution_checker <data_dir> <solution.txt> [solution.txt ...]
+// 输入文件只解析一次，之后依次校验每个解：QoS可达、每天的容量（含上一时刻5%的遗留）、
+// 每条流恰好被分配一次，并计算边缘结点和中心结点的成绩。每天的校验在多个线程上并行进行。
+// 输入文件无法打开时以退出码2结束，与参数错误相同。
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file_parser.hpp"
+#include "residual_demand.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// 一天的校验结果
+struct DayCheck {
+    string error;             // 为空表示合法
+    vector<long> site_loads;  // 当天分配的流量，不含遗留
+    long center_load{0};      // 当天每个服务器上各条流最大值之和
+};
+
+class SolutionChecker {
+public:
+    explicit SolutionChecker(const string &data_dir) : file_parser_(data_dir) {}
+    // 读取所有输入文件，有文件无法打开时返回false
+    bool Load();
+    // 校验一个解并打印成绩，合法时返回true
+    bool Check(const string &solution_filename);
+
+private:
+    FileParser file_parser_;
+    int qos_constraint_{0};
+    int base_cost_{0};
+    double center_cost_{0};
+    vector<Site> sites_;
+    vector<Client> clients_;
+    vector<Demand> demands_;
+    vector<char> accessible_; // [client][site]
+    vector<unordered_map<string, size_t>> stream_index_;
+    vector<size_t> nonzero_count_;
+
+    // 校验第day天对应的行
+    void CheckDay(size_t day, const vector<pair<const char *, const char *>> &lines, ResidualDemand &residual,
+                  vector<int> &stream_max, DayCheck &res) const;
+};
+
+bool SolutionChecker::Load() {
+    string unreadable;
+    if (!file_parser_.CheckInputs(unreadable)) {
+        fprintf(stderr, "cannot open %s\n", unreadable.c_str());
+        return false;
+    }
+    file_parser_.ParseSites(sites_);
+    file_parser_.ParseConfig(qos_constraint_, base_cost_, center_cost_);
+    file_parser_.ParseQOS(clients_, qos_constraint_);
+    while (file_parser_.ParseDemand(clients_.size(), demands_))
+        ;
+    // 没有任何需求行时解析出的是一个空的时刻，每个真实的时刻至少有一行
+    if (demands_.size() == 1 && demands_[0].GetStreamCount() == 0) {
+        demands_.clear();
+    }
+    accessible_.assign(clients_.size() * sites_.size(), 0);
+    for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
+        for (size_t site_idx : clients_[cli_idx].GetAccessibleSite()) {
+            accessible_[cli_idx * sites_.size() + site_idx] = 1;
+        }
+    }
+    stream_index_.resize(demands_.size());
+    nonzero_count_.resize(demands_.size(), 0);
+    for (size_t day = 0; day < demands_.size(); day++) {
+        const auto &d = demands_[day];
+        for (size_t s = 0; s < d.GetStreamCount(); s++) {
+            stream_index_[day][d.GetStreamName(s)] = s;
+            for (size_t cli_idx = 0; cli_idx < clients_.size(); cli_idx++) {
+                if (d.Get(s, cli_idx) != 0) {
+                    nonzero_count_[day]++;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SolutionChecker::CheckDay(size_t day, const vector<pair<const char *, const char *>> &lines,
+                               ResidualDemand &residual, vector<int> &stream_max, DayCheck &res) const {
+    const auto &d = demands_[day];
+    const auto &site_map = file_parser_.GetSiteNameMap();
+    const auto &client_map = file_parser_.GetClientNameMap();
+    size_t client_count = clients_.size();
+    residual.Reset(d);
+    res.site_loads.assign(sites_.size(), 0);
+    stream_max.assign(sites_.size() * d.GetStreamCount(), 0);
+    vector<char> client_seen(client_count, 0);
+    size_t assigned = 0;
+    char msg[256];
+    for (size_t k = day * client_count; k < (day + 1) * client_count; k++) {
+        const char *p = lines[k].first;
+        const char *end = lines[k].second;
+        const char *colon = static_cast<const char *>(memchr(p, ':', end - p));
+        if (colon == nullptr) {
+            snprintf(msg, sizeof(msg), "day %zu line %zu: missing ':'", day, k + 1);
+            res.error = msg;
+            return;
+        }
+        auto cli_it = client_map.find(string(p, colon));
+        if (cli_it == client_map.end() || client_seen[cli_it->second]) {
+            snprintf(msg, sizeof(msg), "day %zu line %zu: unknown or repeated client", day, k + 1);
+            res.error = msg;
+            return;
+        }
+        size_t cli_idx = cli_it->second;
+        client_seen[cli_idx] = 1;
+        p = colon + 1;
+        while (p < end) {
+            if (*p == ',') {
+                p++;
+            }
+            if (p >= end || *p != '<') {
+                snprintf(msg, sizeof(msg), "day %zu line %zu: expect '<'", day, k + 1);
+                res.error = msg;
+                return;
+            }
+            p++;
+            const char *name_end = p;
+            while (name_end < end && *name_end != ',' && *name_end != '>') {
+                name_end++;
+            }
+            auto site_it = site_map.find(string(p, name_end));
+            if (site_it == site_map.end()) {
+                snprintf(msg, sizeof(msg), "day %zu line %zu: unknown site", day, k + 1);
+                res.error = msg;
+                return;
+            }
+            size_t site_idx = site_it->second;
+            if (!accessible_[cli_idx * sites_.size() + site_idx]) {
+                snprintf(msg, sizeof(msg), "day %zu line %zu: site %s violates qos", day, k + 1,
+                         site_it->first.c_str());
+                res.error = msg;
+                return;
+            }
+            p = name_end;
+            while (p < end && *p == ',') {
+                p++;
+                const char *stream_end = p;
+                while (stream_end < end && *stream_end != ',' && *stream_end != '>') {
+                    stream_end++;
+                }
+                auto str_it = stream_index_[day].find(string(p, stream_end));
+                int str_size = str_it == stream_index_[day].end() ? 0 : d.Get(str_it->second, cli_idx);
+                if (str_size == 0) {
+                    snprintf(msg, sizeof(msg), "day %zu line %zu: stream %s not requested", day, k + 1,
+                             string(p, stream_end).c_str());
+                    res.error = msg;
+                    return;
+                }
+                if (residual.IsConsumed(str_it->second, cli_idx)) {
+                    snprintf(msg, sizeof(msg), "day %zu line %zu: stream %s allocated twice", day, k + 1,
+                             str_it->first.c_str());
+                    res.error = msg;
+                    return;
+                }
+                residual.Consume(str_it->second, cli_idx);
+                assigned++;
+                res.site_loads[site_idx] += str_size;
+                int &cur_max = stream_max[site_idx * d.GetStreamCount() + str_it->second];
+                cur_max = max(cur_max, str_size);
+                p = stream_end;
+            }
+            if (p >= end || *p != '>') {
+                snprintf(msg, sizeof(msg), "day %zu line %zu: expect '>'", day, k + 1);
+                res.error = msg;
+                return;
+            }
+            p++;
+        }
+    }
+    if (assigned != nonzero_count_[day]) {
+        snprintf(msg, sizeof(msg), "day %zu: %zu of %zu streams not allocated", day, nonzero_count_[day] - assigned,
+                 nonzero_count_[day]);
+        res.error = msg;
+        return;
+    }
+    res.center_load = 0;
+    for (int m : stream_max) {
+        res.center_load += m;
+    }
+}
+
+bool SolutionChecker::Check(const string &solution_filename) {
+    FILE *fp = fopen(solution_filename.c_str(), "rb");
+    if (fp == nullptr) {
+        printf("%s: cannot open\n", solution_filename.c_str());
+        return false;
+    }
+    // 一次读入整个文件，之后只在内存中按行切分
+    string buf;
+    fseek(fp, 0, SEEK_END);
+    buf.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    size_t read_size = fread(&buf[0], 1, buf.size(), fp);
+    fclose(fp);
+    buf.resize(read_size);
+
+    vector<pair<const char *, const char *>> lines;
+    const char *p = buf.data();
+    const char *end = p + buf.size();
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char *line_end = eol == nullptr ? end : eol;
+        const char *trim = line_end;
+        if (trim > p && trim[-1] == '\r') {
+            trim--;
+        }
+        lines.push_back({p, trim});
+        p = eol == nullptr ? end : eol + 1;
+    }
+    size_t days = demands_.size();
+    if (lines.size() != days * clients_.size()) {
+        printf("%s: expect %zu lines, got %zu\n", solution_filename.c_str(), days * clients_.size(), lines.size());
+        return false;
+    }
+    // 没有任何时刻时不存在95分位值，成绩为0
+    if (days == 0) {
+        printf("%s: OK edge grade = 0, center grade = 0, total grade = 0\n", solution_filename.c_str());
+        return true;
+    }
+
+    vector<DayCheck> checks(days);
+    // 每个工作线程复用自己的剩余需求和每条流的最大值
+    auto &pool = ThreadPool::Instance();
+    vector<ResidualDemand> residuals(pool.GetWorkerCount());
+    vector<vector<int>> stream_maxes(pool.GetWorkerCount());
+    pool.ParallelFor(0, days, 8, [&](size_t day) {
+        size_t worker = ThreadPool::CurrentWorker();
+        CheckDay(day, lines, residuals[worker], stream_maxes[worker], checks[day]);
+    });
+    for (const auto &c : checks) {
+        if (!c.error.empty()) {
+            printf("%s: %s\n", solution_filename.c_str(), c.error.c_str());
+            return false;
+        }
+    }
+
+    // 遗留流量依赖前一天的结果，只能按天顺序计算
+    // 上一时刻总流量的5%（向下取整）计入当前时刻
+    vector<vector<long>> loads(sites_.size(), vector<long>(days, 0));
+    for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+        long prev = 0;
+        for (size_t day = 0; day < days; day++) {
+            long cur = checks[day].site_loads[site_idx] + prev / 20;
+            if (cur > sites_[site_idx].GetTotalBandwidth()) {
+                printf("%s: day %zu site %s exceeds bandwidth (%ld > %d)\n", solution_filename.c_str(), day,
+                       sites_[site_idx].GetName(), cur, sites_[site_idx].GetTotalBandwidth());
+                return false;
+            }
+            loads[site_idx][day] = cur;
+            prev = cur;
+        }
+    }
+
+    size_t sep_idx = ceil(days * 0.95) - 1;
+    double edge_grade = 0;
+    for (size_t site_idx = 0; site_idx < sites_.size(); site_idx++) {
+        auto &arr = loads[site_idx];
+        long max_load = *max_element(arr.begin(), arr.end());
+        if (max_load == 0) {
+            continue;
+        }
+        nth_element(arr.begin(), arr.begin() + sep_idx, arr.end());
+        long sep = arr[sep_idx];
+        if (sep <= base_cost_) {
+            edge_grade += base_cost_;
+        } else {
+            edge_grade += pow(1.0 * (sep - base_cost_), 2) / sites_[site_idx].GetTotalBandwidth() + sep;
+        }
+    }
+    vector<long> center_loads;
+    for (const auto &c : checks) {
+        center_loads.push_back(c.center_load);
+    }
+    nth_element(center_loads.begin(), center_loads.begin() + sep_idx, center_loads.end());
+    // 与CodeCraft-2022相同，center grade为95分位的中心结点负载，计入总成绩时乘以center_cost
+    long center_grade = center_loads[sep_idx];
+    printf("%s: OK edge grade = %.0f, center grade = %ld, total grade = %.0f\n", solution_filename.c_str(),
+           edge_grade, center_grade, round(edge_grade + center_grade * center_cost_));
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <data_dir> <solution.txt> [solution.txt ...]\n", argv[0]);
+        return 2;
+    }
+    auto start = chrono::high_resolution_clock::now();
+    SolutionChecker checker(argv[1]);
+    if (!checker.Load()) {
+        fprintf(stderr, "usage: %s <data_dir> <solution.txt> [solution.txt ...]\n", argv[0]);
+        return 2;
+    }
+    int failed = 0;
+    for (int i = 2; i < argc; i++) {
+        if (!checker.Check(argv[i])) {
+            failed++;
+        }
+    }
+    auto end = chrono::high_resolution_clock::now();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(end - start);
+    printf("checked %d solutions, %d invalid, time taken: %ld ms\n", argc - 2, failed,
+           static_cast<long>(duration.count()));
+    return failed == 0 ? 0 : 1;
+}
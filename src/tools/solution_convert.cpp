@@ -0,0 +1,37 @@
+// 二进制列式解转换为文本
+// 用法: solution_convert <solution.bin> <solution.txt>
+// 输出与调度程序写出的solution.txt逐字节相同，输出文件为"-"时写到标准输出
+#include <cstdio>
+#include <string>
+
+#include "solution_format.hpp"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <solution.bin> <solution.txt>\n", argv[0]);
+        return 2;
+    }
+    solution_format::Reader reader;
+    if (!reader.Open(argv[1])) {
+        fprintf(stderr, "%s: not a binary solution\n", argv[1]);
+        return 1;
+    }
+    string out_name = argv[2];
+    FILE *fp = out_name == "-" ? stdout : fopen(out_name.c_str(), "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "cannot open %s\n", out_name.c_str());
+        return 1;
+    }
+    string text;
+    for (size_t day = 0; day < reader.GetDayCount(); day++) {
+        text.clear();
+        reader.FormatDay(day, text);
+        fwrite(text.data(), 1, text.size(), fp);
+    }
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    return 0;
+}